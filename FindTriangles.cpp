@@ -1,65 +1,98 @@
 // ReSharper disable CppInconsistentNaming
-#include <algorithm>
-#include <iomanip>
-#include <iostream>
-#include <vector>
-#include <chrono>
+#include "FindTriangles.h"
+#include "FindTrianglesC.h"
+
+// use the widest vector instructions the compiler targets
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FIND_TRIANGLES_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FIND_TRIANGLES_SSE2
+#endif
 
 using namespace std;
 
-// Margin of error for comparing floats
-static constexpr double compare_tolerance = .00001;
+// calculate the distance between 2 points
+double calc_distance(const point& a, const point& b)
+{
+    const auto dx = static_cast<double>(b.x) - a.x;
+    const auto dy = static_cast<double>(b.y) - a.y;
+    return sqrt(dx * dx + dy * dy);
+}
+
+// calculate twice the signed area of the triangle a, b, c
+// positive when the points turn counter clockwise
+double calc_cross(const point& a, const point& b, const point& c)
+{
+    return (static_cast<double>(b.x) - a.x) * (static_cast<double>(c.y) - a.y) -
+        (static_cast<double>(b.y) - a.y) * (static_cast<double>(c.x) - a.x);
+}
+
+// determine if a triangle with a given first point can meet a filter
+bool can_meet(const triangle_filter& filter, const point& a)
+{
+    return !filter.bounded || filter.bounds.contains(a);
+}
 
-// Define a point structure
-// with floats for x and y
-// override the == operator to compare to another point
-typedef struct point
+// determine if a triangle with 2 given points can meet a filter
+// the perimeter is at least twice the side a b
+// inside the bounds the third point is at most as far from the
+// line through a and b as the farthest corner, which limits the area
+bool can_meet(const triangle_filter& filter, const point& a, const point& b)
 {
-    float x;
-    float y;
+    if (!can_meet(filter, a) || !can_meet(filter, b))
+        return false;
 
-    point(const float x, const float y)
-        : x(x),
-        y(y)
-    {}
+    const auto side = calc_distance(a, b);
+    if (2 * side > filter.max_perimeter)
+        return false;
 
-    bool operator==(const point& other) const
+    if (filter.bounded && filter.min_area > 0)
     {
-        return abs(x - other.x) < compare_tolerance && abs(y - other.y) < compare_tolerance;
+        const point corners[4] =
+        {
+            point(filter.bounds.min_x, filter.bounds.min_y),
+            point(filter.bounds.max_x, filter.bounds.min_y),
+            point(filter.bounds.min_x, filter.bounds.max_y),
+            point(filter.bounds.max_x, filter.bounds.max_y),
+        };
+        auto largest = 0.0;
+        for (const auto& corner : corners)
+            largest = max(largest, abs(calc_cross(a, b, corner)));
+        if (largest / 2 < filter.min_area)
+            return false;
     }
-} point;
-
+    return true;
+}
 
-// Define a line segment structure as 2 points
-typedef struct line_segment
+// determine if a triangle meets a filter
+bool meets(const triangle_filter& filter, const point& a, const point& b, const point& c)
 {
-    point p1;
-    point p2;
-
-    line_segment(const float a, const float b, const float c, const float d)
-        : p1(a, b),
-        p2(c, d)
-    {}
+    if (!can_meet(filter, a) || !can_meet(filter, b) || !can_meet(filter, c))
+        return false;
 
-    line_segment(const point& p1, const point& p2)
-        : p1(p1),
-        p2(p2)
-    {}
-} line_segment;
+    const auto area = abs(calc_cross(a, b, c)) / 2;
+    if (area < filter.min_area || area > filter.max_area)
+        return false;
 
-// define a triangle structure as 3 points
-typedef struct triangle
-{
-    point p1;
-    point p2;
-    point p3;
+    const auto side_ab = calc_distance(a, b);
+    const auto side_bc = calc_distance(b, c);
+    const auto side_ca = calc_distance(c, a);
+    if (side_ab + side_bc + side_ca > filter.max_perimeter)
+        return false;
 
-    triangle(const point& p1, const point& p2, const point& p3)
-        : p1(p1),
-        p2(p2),
-        p3(p3)
-    {}
-} triangle;
+    if (filter.min_angle > 0)
+    {
+        // the smallest angle is opposite the shortest side
+        // the law of sines gives sin(angle) = 2 * area / (product of the other 2 sides)
+        const auto shortest = min({ side_ab, side_bc, side_ca });
+        const auto others = side_ab * side_bc * side_ca / shortest;
+        if (others == 0 || asin(min(1.0, 2 * area / others)) < filter.min_angle)
+            return false;
+    }
+    return true;
+}
 
 // determine if a given point is contained in a vector of points
 bool find_point(vector<point>& points, const point& pt)
@@ -67,6 +100,74 @@ bool find_point(vector<point>& points, const point& pt)
     return find(points.begin(), points.end(), pt) != points.end();
 }
 
+// the tolerance of point::operator== as a float
+// abs(a - b) <= point_tolerance gives the same answer as
+// abs(a - b) < compare_tolerance after the promotion to double
+float calc_point_tolerance()
+{
+    const auto tolerance = static_cast<float>(compare_tolerance);
+    return tolerance < compare_tolerance ? tolerance : nextafter(tolerance, 0.0f);
+}
+
+static const float point_tolerance = calc_point_tolerance();
+
+// determine if a given point is contained in a list of points
+// the x and y distance of 8 points is checked against the tolerance at a time
+bool find_point(const point_list& points, const point& pt)
+{
+    const auto count = points.size();
+    const auto* xs = points.x.data();
+    const auto* ys = points.y.data();
+    auto index = 0;
+
+#if defined(FIND_TRIANGLES_AVX)
+    const auto sign = _mm256_set1_ps(-0.0f);
+    const auto tolerance = _mm256_set1_ps(point_tolerance);
+    const auto px = _mm256_set1_ps(pt.x);
+    const auto py = _mm256_set1_ps(pt.y);
+    for (; index + 8 <= count; index += 8)
+    {
+        const auto dx = _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_loadu_ps(xs + index), px));
+        const auto dy = _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_loadu_ps(ys + index), py));
+        const auto inside = _mm256_and_ps(_mm256_cmp_ps(dx, tolerance, _CMP_LE_OQ), _mm256_cmp_ps(dy, tolerance, _CMP_LE_OQ));
+        if (_mm256_movemask_ps(inside))
+            return true;
+    }
+#elif defined(FIND_TRIANGLES_SSE2)
+    const auto sign = _mm_set1_ps(-0.0f);
+    const auto tolerance = _mm_set1_ps(point_tolerance);
+    const auto px = _mm_set1_ps(pt.x);
+    const auto py = _mm_set1_ps(pt.y);
+    for (; index + 8 <= count; index += 8)
+    {
+        const auto dx0 = _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(xs + index), px));
+        const auto dy0 = _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(ys + index), py));
+        const auto dx1 = _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(xs + index + 4), px));
+        const auto dy1 = _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(ys + index + 4), py));
+        const auto inside0 = _mm_and_ps(_mm_cmple_ps(dx0, tolerance), _mm_cmple_ps(dy0, tolerance));
+        const auto inside1 = _mm_and_ps(_mm_cmple_ps(dx1, tolerance), _mm_cmple_ps(dy1, tolerance));
+        if (_mm_movemask_ps(_mm_or_ps(inside0, inside1)))
+            return true;
+    }
+#endif
+
+    for (; index < count; ++index)
+    {
+        if (abs(xs[index] - pt.x) <= point_tolerance && abs(ys[index] - pt.y) <= point_tolerance)
+            return true;
+    }
+    return false;
+}
+
+// copy vectors of points into point lists
+void to_point_lists(const vector<vector<point>>& intersects, vector<point_list>& lists)
+{
+    lists.clear();
+    lists.reserve(intersects.size());
+    for (const auto& points : intersects)
+        lists.emplace_back(points);
+}
+
 // calculate the intersection of 2 line segments
 // segment 1 = points A and B
 // segment 2 = points C and D
@@ -146,37 +247,691 @@ bool calc_intersection(const line_segment& ls1, const line_segment& ls2, point&
     return calc_intersection(ls1.p1, ls1.p2, ls2.p1, ls2.p2, pt);
 }
 
+// calculate the intersection of 2 line segments without branches
+// the same terms as calc_intersection but the denominator, t and u tests
+// are combined into a hit mask instead of returning early
+// the point is always calculated and is only valid when true is returned
+// use when the hits are close to random and the branches mispredict
+bool calc_intersection_branchless(const line_segment& ls1, const line_segment& ls2, point& pt)
+{
+    const auto x1 = ls1.p1.x;
+    const auto y1 = ls1.p1.y;
+    const auto x2 = ls1.p2.x;
+    const auto y2 = ls1.p2.y;
+    const auto x3 = ls2.p1.x;
+    const auto y3 = ls2.p1.y;
+    const auto x4 = ls2.p2.x;
+    const auto y4 = ls2.p2.y;
+
+    // simplify terms
+    const auto x1_x2 = x1 - x2;
+    const auto x1_x3 = x1 - x3;
+    const auto x2_x1 = x2 - x1;
+    const auto x3_x4 = x3 - x4;
+    const auto y1_y2 = y1 - y2;
+    const auto y1_y3 = y1 - y3;
+    const auto y2_y1 = y2 - y1;
+    const auto y3_y4 = y3 - y4;
+
+    // divide by 1 instead of a 0 denominator, the mask discards the result
+    const auto denominator = x1_x2 * y3_y4 - y1_y2 * x3_x4;
+    const bool valid = !(abs(denominator) < compare_tolerance);
+    const auto divisor = valid ? denominator : 1.0f;
+
+    const auto t = (x1_x3 * y3_y4 - y1_y3 * x3_x4) / divisor;
+    const auto u = (x1_x3 * y1_y2 - y1_y3 * x1_x2) / divisor;
+
+    const bool hit = valid & !(t < 0) & !(t > 1) & !(u < 0) & !(u > 1);
+    pt = point(x1 + t * x2_x1, y1 + t * y2_y1);
+    return hit;
+}
+
+// add an intersection to the lists of both its line segments
+void add_intersection(vector<point_list>& intersects, const int i, const int j, const point& pt)
+{
+    if (!find_point(intersects[i], pt))
+        intersects[i].push_back(pt);
+
+    if (!find_point(intersects[j], pt))
+        intersects[j].push_back(pt);
+}
+
+// calculate the intersections of line segments
+// given a vector of line segments
+// output the intersections in a vector of point lists
+// lists[N] will output a list of all the intersections in line segment N
+// kernel selects the branching or branchless intersection test
+void calc_intersections(const segment_view& segments, vector<point_list>& intersects, const intersection_kernel kernel)
+{
+    select_intersection_kernel(kernel, [&](auto intersect)
+    {
+        calc_intersections(segments, intersect, intersects);
+    });
+}
+
 // calculate the intersections of line segments
 // given a vector of line segments
 // output the intersections in a vector of point vectors
-// vector[0] will output a vector of all the intersections in line segment 0
-// vector[1] will output a vector of all the intersections in line segment 1
 // vector[N] will output a vector of all the intersections in line segment N
-void calc_intersections(const vector<line_segment>& segments, vector<vector<point>>& intersects)
+// kernel selects the branching or branchless intersection test
+void calc_intersections(const segment_view& segments, vector<vector<point>>& intersects, const intersection_kernel kernel)
+{
+    vector<point_list> lists(intersects.size());
+    calc_intersections(segments, lists, kernel);
+
+    for (auto i = 0; i < static_cast<int>(lists.size()); ++i)
+    {
+        for (auto k = 0; k < lists[i].size(); ++k)
+            intersects[i].push_back(lists[i][k]);
+    }
+}
+
+// spread the lower 16 bits of a value so there is
+// a 0 bit between each of them
+// used to interleave x and y into a morton key
+uint32_t spread_bits(uint32_t value)
+{
+    value &= 0x0000ffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+// calculate the spatial order of line segments
+// the midpoint of each segment is quantized to 16 bits per axis
+// inside the bounds of all midpoints and interleaved into a morton key
+// order[0] will output the index of the first segment along the curve
+// order[N] will output the index of the Nth segment along the curve
+// segments that are close together end up close together in the order
+// segments with a non finite midpoint are put at the end
+void calc_spatial_order(const segment_view& segments, vector<int>& order)
+{
+    const int num_line_segments = static_cast<int>(segments.size());
+    order.resize(num_line_segments);
+    if (num_line_segments == 0)
+        return;
+
+    // the midpoints are calculated in double so they cannot overflow
+    // non finite segments are left out of the bounds
+    vector<pair<double, double>> midpoints;
+    midpoints.reserve(num_line_segments);
+    auto min_x = numeric_limits<double>::infinity();
+    auto min_y = numeric_limits<double>::infinity();
+    auto max_x = -numeric_limits<double>::infinity();
+    auto max_y = -numeric_limits<double>::infinity();
+    for (const auto& segment : segments)
+    {
+        midpoints.emplace_back((static_cast<double>(segment.p1.x) + segment.p2.x) / 2, (static_cast<double>(segment.p1.y) + segment.p2.y) / 2);
+        const auto& midpoint = midpoints.back();
+        if (isfinite(midpoint.first) && isfinite(midpoint.second))
+        {
+            min_x = min(min_x, midpoint.first);
+            min_y = min(min_y, midpoint.second);
+            max_x = max(max_x, midpoint.first);
+            max_y = max(max_y, midpoint.second);
+        }
+    }
+
+    // scale the bounds to the 16 bit grid
+    // a zero extent collapses every key on that axis to 0
+    const auto scale_x = max_x > min_x ? 65535.0 / (max_x - min_x) : 0.0;
+    const auto scale_y = max_y > min_y ? 65535.0 / (max_y - min_y) : 0.0;
+    auto quantize = [](const double value)
+    {
+        return static_cast<uint32_t>(max(0.0, min(65535.0, value)));
+    };
+
+    // the keys of non finite segments go after every morton key
+    // so those segments are put at the end of the order
+    vector<uint64_t> keys(num_line_segments);
+    for (auto i = 0; i < num_line_segments; ++i)
+    {
+        const auto& midpoint = midpoints[i];
+        if (isfinite(midpoint.first) && isfinite(midpoint.second))
+        {
+            const auto grid_x = quantize((midpoint.first - min_x) * scale_x);
+            const auto grid_y = quantize((midpoint.second - min_y) * scale_y);
+            keys[i] = spread_bits(grid_x) | (spread_bits(grid_y) << 1);
+        }
+        else
+        {
+            keys[i] = static_cast<uint64_t>(1) << 32;
+        }
+        order[i] = i;
+    }
+
+    stable_sort(order.begin(), order.end(), [&keys](const int a, const int b) { return keys[a] < keys[b]; });
+}
+
+// reorder line segments
+// given a vector of line segments and the order from calc_spatial_order
+// reordered[N] will output segments[order[N]]
+void reorder_segments(const segment_view& segments, const vector<int>& order, vector<line_segment>& reordered)
+{
+    reordered.clear();
+    reordered.reserve(order.size());
+    for (const auto index : order)
+        reordered.push_back(segments[index]);
+}
+
+// calculate the intersections of line segments in spatial order
+// the segments are reordered along the morton curve before calculating
+// so segments likely to cross are close together in memory
+// the intersections are mapped back so intersects[N] still belongs to segments[N]
+void calc_intersections_spatial(const segment_view& segments, vector<vector<point>>& intersects)
+{
+    vector<int> order;
+    vector<line_segment> reordered;
+    calc_spatial_order(segments, order);
+    reorder_segments(segments, order, reordered);
+
+    // the segment with the lower original index goes first so the
+    // intersection point is rounded the same way as calc_intersections
+    const auto num_line_segments = static_cast<int>(reordered.size());
+    vector<point_list> lists(num_line_segments);
+    visit_intersections(num_line_segments,
+        [&](const int i, const int j, point& pt)
+        {
+            const auto in_order = order[i] < order[j];
+            return calc_intersection(reordered[in_order ? i : j], reordered[in_order ? j : i], pt);
+        },
+        [&lists](const int i, const int j, const point& pt) { add_intersection(lists, i, j, pt); });
+
+    for (auto i = 0; i < num_line_segments; ++i)
+    {
+        auto& output = intersects[order[i]];
+        output.clear();
+        for (auto k = 0; k < lists[i].size(); ++k)
+            output.push_back(lists[i][k]);
+    }
+}
+
+// determine if all 4 coordinates of a line segment are finite
+// and if its 2 end points are the same point
+// both tests are done on all coordinates at once
+void check_segment(const line_segment& segment, bool& finite, bool& zero_length)
+{
+#if defined(FIND_TRIANGLES_AVX) || defined(FIND_TRIANGLES_SSE2)
+    const auto coords = _mm_loadu_ps(&segment.p1.x);
+    const auto zero = _mm_setzero_ps();
+
+    // x * 0 is 0 for a finite x and NaN for NaN or Inf
+    finite = _mm_movemask_ps(_mm_cmpeq_ps(_mm_mul_ps(coords, zero), zero)) == 0xf;
+
+    // compare x1, y1 with x2, y2 using the tolerance of point::operator==
+    const auto swapped = _mm_shuffle_ps(coords, coords, _MM_SHUFFLE(1, 0, 3, 2));
+    const auto distance = _mm_andnot_ps(_mm_set1_ps(-0.0f), _mm_sub_ps(coords, swapped));
+    zero_length = (_mm_movemask_ps(_mm_cmple_ps(distance, _mm_set1_ps(point_tolerance))) & 0x3) == 0x3;
+#else
+    finite = isfinite(segment.p1.x) && isfinite(segment.p1.y) && isfinite(segment.p2.x) && isfinite(segment.p2.y);
+    zero_length = segment.p1 == segment.p2;
+#endif
+}
+
+// filter degenerate line segments from the input
+// given a vector of line segments
+// output the usable segments in filtered
+// segments with a NaN or Inf coordinate, zero length segments
+// and exact duplicates of an earlier segment are removed
+// report will output the original index of every kept and removed segment
+void filter_degenerate_segments(const segment_view& segments, vector<line_segment>& filtered, filter_report& report)
+{
+    filtered.clear();
+    report = filter_report();
+    filtered.reserve(segments.size());
+    report.kept.reserve(segments.size());
+
+    unordered_map<segment_key, int, segment_key_hash> seen;
+    seen.reserve(segments.size());
+    for (auto i = 0; i < static_cast<int>(segments.size()); ++i)
+    {
+        bool finite;
+        bool zero_length;
+        check_segment(segments[i], finite, zero_length);
+
+        if (!finite)
+            report.non_finite.push_back(i);
+        else if (zero_length)
+            report.zero_length.push_back(i);
+        else
+        {
+            const auto found = seen.emplace(segment_key(segments[i]), i);
+            if (!found.second)
+            {
+                report.duplicates.push_back(i);
+                report.duplicate_of.push_back(found.first->second);
+                continue;
+            }
+
+            report.kept.push_back(i);
+            filtered.push_back(segments[i]);
+        }
+    }
+}
+
+// calculate the supporting line of a line segment
+// the direction is flipped so both ends of the segment give the same line
+supporting_line calc_supporting_line(const line_segment& segment)
+{
+    auto dx = static_cast<double>(segment.p2.x) - segment.p1.x;
+    auto dy = static_cast<double>(segment.p2.y) - segment.p1.y;
+    if (dx < 0 || (dx == 0 && dy < 0))
+    {
+        dx = -dx;
+        dy = -dy;
+    }
+
+    const auto length = sqrt(dx * dx + dy * dy);
+    dx /= length;
+    dy /= length;
+
+    const auto along_1 = dx * segment.p1.x + dy * segment.p1.y;
+    const auto along_2 = dx * segment.p2.x + dy * segment.p2.y;
+    return { atan2(dy, dx), dx * segment.p1.y - dy * segment.p1.x, min(along_1, along_2), max(along_1, along_2), along_2 < along_1 };
+}
+
+// pi radians, the angle between the 2 directions of a line
+static constexpr double half_turn = 3.14159265358979323846;
+
+// turn a supporting line around so its angle is a half turn higher
+void flip_supporting_line(supporting_line& line)
+{
+    const auto start = line.start;
+    line.angle += half_turn;
+    line.offset = -line.offset;
+    line.start = -line.end;
+    line.end = -start;
+    line.flipped = !line.flipped;
+}
+
+// calculate the distance of a point from a supporting line
+double calc_line_distance(const supporting_line& line, const point& pt)
+{
+    return abs(cos(line.angle) * pt.y - sin(line.angle) * pt.x - line.offset);
+}
+
+// merge collinear line segments that overlap, touch or are duplicates
+// given a vector of line segments
+// output the merged segments in merged
+// mapping[N] will output the index in merged of segments[N]
+// the segments are grouped by the angle and offset of their supporting line
+// to find candidates, then each group is swept along the line and a segment
+// joins a piece only when both its ends are within the tolerance of the line
+// of the first segment of the piece
+// merged keeps the order of the first segment of each merged piece
+// and a segment that is not merged is output unchanged
+// zero length segments have no supporting line and are kept as they are
+void merge_collinear_segments(const vector<line_segment>& segments, vector<line_segment>& merged, vector<int>& mapping)
+{
+    const int num_line_segments = static_cast<int>(segments.size());
+    vector<supporting_line> lines(num_line_segments);
+    vector<int> order;
+    order.reserve(num_line_segments);
+    for (auto i = 0; i < num_line_segments; ++i)
+    {
+        if (segments[i].p1 == segments[i].p2)
+            continue;
+
+        lines[i] = calc_supporting_line(segments[i]);
+        order.push_back(i);
+    }
+
+    sort(order.begin(), order.end(), [&lines](const int a, const int b) { return lines[a].angle < lines[b].angle; });
+
+    // the angles wrap around at +-pi/2, so near vertical lines can sit at both ends
+    // start the sweep after a gap in the angles and turn the lines
+    // before the gap around so they follow on from the lines after it
+    const auto num_lines = order.size();
+    size_t sweep_start = 0;
+    for (size_t k = 0; k < num_lines; ++k)
+    {
+        const auto gap = k == 0
+            ? lines[order[0]].angle + half_turn - lines[order[num_lines - 1]].angle
+            : lines[order[k]].angle - lines[order[k - 1]].angle;
+        if (gap >= compare_tolerance)
+        {
+            sweep_start = k;
+            break;
+        }
+    }
+    for (size_t k = 0; k < sweep_start; ++k)
+        flip_supporting_line(lines[order[k]]);
+    rotate(order.begin(), order.begin() + sweep_start, order.end());
+
+    // piece_of[N] is the piece segments[N] is merged into
+    // the segments of a piece reach from the start of first to the end of last
+    // lowest is the lowest index of the segments in the piece
+    vector<int> piece_of(num_line_segments, -1);
+    vector<int> piece_first;
+    vector<int> piece_last;
+    vector<int> piece_lowest;
+    vector<int> open;
+
+    for (size_t angle_begin = 0; angle_begin < num_lines;)
+    {
+        // candidates with about the same direction
+        auto angle_end = angle_begin + 1;
+        while (angle_end < num_lines && lines[order[angle_end]].angle - lines[order[angle_end - 1]].angle < compare_tolerance)
+            ++angle_end;
+
+        sort(order.begin() + angle_begin, order.begin() + angle_end,
+            [&lines](const int a, const int b) { return lines[a].offset < lines[b].offset; });
+
+        for (auto line_begin = angle_begin; line_begin < angle_end;)
+        {
+            // candidates on about the same supporting line
+            auto line_end = line_begin + 1;
+            while (line_end < angle_end && lines[order[line_end]].offset - lines[order[line_end - 1]].offset < compare_tolerance)
+                ++line_end;
+
+            sort(order.begin() + line_begin, order.begin() + line_end,
+                [&lines](const int a, const int b) { return lines[a].start < lines[b].start; });
+
+            // sweep along the line joining segments that overlap or touch
+            // a piece stays open until a segment starts past its end
+            open.clear();
+            for (auto k = line_begin; k < line_end; ++k)
+            {
+                const auto index = order[k];
+                open.erase(remove_if(open.begin(), open.end(), [&](const int piece)
+                {
+                    return lines[index].start - lines[piece_last[piece]].end >= compare_tolerance;
+                }), open.end());
+
+                auto piece = -1;
+                for (const auto candidate : open)
+                {
+                    const auto& line = lines[piece_first[candidate]];
+                    if (calc_line_distance(line, segments[index].p1) < compare_tolerance &&
+                        calc_line_distance(line, segments[index].p2) < compare_tolerance)
+                    {
+                        piece = candidate;
+                        break;
+                    }
+                }
+
+                if (piece < 0)
+                {
+                    piece = static_cast<int>(piece_first.size());
+                    piece_first.push_back(index);
+                    piece_last.push_back(index);
+                    piece_lowest.push_back(index);
+                    open.push_back(piece);
+                }
+                else
+                {
+                    if (lines[index].end > lines[piece_last[piece]].end)
+                        piece_last[piece] = index;
+                    piece_lowest[piece] = min(piece_lowest[piece], index);
+                }
+                piece_of[index] = piece;
+            }
+            line_begin = line_end;
+        }
+        angle_begin = angle_end;
+    }
+
+    // output the pieces in the order of their lowest segment
+    merged.clear();
+    mapping.assign(num_line_segments, -1);
+    vector<int> piece_index(piece_first.size(), -1);
+    for (auto i = 0; i < num_line_segments; ++i)
+    {
+        const auto piece = piece_of[i];
+        if (piece < 0)
+        {
+            mapping[i] = static_cast<int>(merged.size());
+            merged.push_back(segments[i]);
+            continue;
+        }
+
+        if (piece_lowest[piece] == i)
+        {
+            piece_index[piece] = static_cast<int>(merged.size());
+            const auto first = piece_first[piece];
+            const auto last = piece_last[piece];
+            if (first == i && last == i)
+            {
+                merged.push_back(segments[i]);
+            }
+            else
+            {
+                const auto& start = lines[first].flipped ? segments[first].p2 : segments[first].p1;
+                const auto& end = lines[last].flipped ? segments[last].p1 : segments[last].p2;
+                merged.emplace_back(start, end);
+            }
+        }
+        mapping[i] = piece_index[piece];
+    }
+}
+
+// calculate the crossing graph of line segments
+// the segments are visited in spatial order so crossing segments
+// get labels that are close together
+// graph.labels maps each vertex back to the index in segments
+void calc_crossing_graph(const segment_view& segments, crossing_graph& graph, const intersection_kernel kernel,
+    const atomic<bool>* cancel)
+{
+    vector<line_segment> reordered;
+    calc_spatial_order(segments, graph.labels);
+    reorder_segments(segments, graph.labels, reordered);
+
+    const int num_line_segments = static_cast<int>(reordered.size());
+    graph.adjacency.clear();
+    graph.adjacency.resize(num_line_segments);
+
+    // the segment with the lower original index goes first so the
+    // intersection point is rounded the same way as calc_intersections
+    const auto& labels = graph.labels;
+    select_intersection_kernel(kernel, [&](auto intersect)
+    {
+        visit_intersections(num_line_segments,
+            [&](const int i, const int j, point& pt)
+            {
+                const auto in_order = labels[i] < labels[j];
+                return intersect(reordered[in_order ? i : j], reordered[in_order ? j : i], pt);
+            },
+            [&graph](const int i, const int j, const point& pt)
+            {
+                graph.adjacency[i].emplace_back(j, pt);
+                graph.adjacency[j].emplace_back(i, pt);
+            },
+            [cancel] { return cancel != nullptr && cancel->load(memory_order_relaxed); });
+    });
+
+    // the tiles do not visit the pairs in order of the second segment
+    for (auto& edges : graph.adjacency)
+        sort(edges.begin(), edges.end(), [](const crossing& a, const crossing& b) { return a.segment < b.segment; });
+    cluster_crossing_points(graph);
+}
+
+// calculate the cell of a coordinate in a grid the size of compare_tolerance
+// the cell index is clamped so huge coordinates cannot overflow
+// they share the cells at the edge, which only costs time
+static long long calc_tolerance_cell(const float value)
+{
+    static constexpr double limit = 1e18;
+    return static_cast<long long>(floor(max(-limit, min(limit, value / compare_tolerance))));
+}
+
+// cluster the crossing points of a crossing graph into vertices
+// each point is put in a grid cell the size of the tolerance and the cells
+// are sorted, so the points a point can equal are found in the 3 by 3 cells
+// around it with a binary search and the clustering takes about n log n
+int cluster_crossing_points(crossing_graph& graph)
 {
-    for (auto i = 0; i < static_cast<int>(segments.size()) - 1; ++i)
+    // each crossing point is in the lists of both its segments
+    // it is clustered once, from the list of the lower segment
+    vector<point> points;
+    for (auto a = 0; a < static_cast<int>(graph.adjacency.size()); ++a)
+    {
+        for (auto& edge : graph.adjacency[a])
+        {
+            if (edge.segment > a)
+            {
+                edge.vertex = static_cast<int>(points.size());
+                points.push_back(edge.pt);
+            }
+        }
+    }
+
+    typedef tuple<long long, long long, int> point_cell;
+    vector<point_cell> cells;
+    cells.reserve(points.size());
+    for (auto i = 0; i < static_cast<int>(points.size()); ++i)
+        cells.emplace_back(calc_tolerance_cell(points[i].x), calc_tolerance_cell(points[i].y), i);
+    sort(cells.begin(), cells.end());
+
+    point_clusters clusters(static_cast<int>(points.size()));
+    for (const auto& cell : cells)
+    {
+        const auto column = get<0>(cell);
+        const auto row = get<1>(cell);
+        const auto i = get<2>(cell);
+        for (auto d_column = -1; d_column <= 1; ++d_column)
+        {
+            for (auto d_row = -1; d_row <= 1; ++d_row)
+            {
+                // only the points after i are compared, the ones before have compared with i
+                auto neighbor = lower_bound(cells.begin(), cells.end(), point_cell(column + d_column, row + d_row, i + 1));
+                for (; neighbor != cells.end() && get<0>(*neighbor) == column + d_column && get<1>(*neighbor) == row + d_row; ++neighbor)
+                {
+                    if (points[get<2>(*neighbor)] == points[i])
+                        clusters.merge(i, get<2>(*neighbor));
+                }
+            }
+        }
+    }
+
+    // number the vertices in order of their first point
+    vector<int> vertex_of(points.size(), -1);
+    auto num_vertices = 0;
+    for (auto i = 0; i < static_cast<int>(points.size()); ++i)
+    {
+        auto& vertex = vertex_of[clusters.find(i)];
+        if (vertex < 0)
+            vertex = num_vertices++;
+        vertex_of[i] = vertex;
+    }
+
+    // the lower segment of each crossing comes first so its id is ready for the higher one
+    for (auto a = 0; a < static_cast<int>(graph.adjacency.size()); ++a)
     {
-        for (auto j = i + 1; j < static_cast<int>(segments.size()); ++j)
+        for (auto& edge : graph.adjacency[a])
         {
-            point intersect_pt(0, 0);
-            if (calc_intersection(segments[i], segments[j], intersect_pt))
+            if (edge.segment > a)
             {
-                if (!find_point(intersects[i], intersect_pt))
-                    intersects[i].push_back(intersect_pt);
+                edge.vertex = vertex_of[edge.vertex];
+                continue;
+            }
+
+            const auto& edges = graph.adjacency[edge.segment];
+            const auto mirror = lower_bound(edges.begin(), edges.end(), a,
+                [](const crossing& other, const int value) { return other.segment < value; });
+            edge.vertex = mirror->vertex;
+        }
+    }
+    return num_vertices;
+}
+
+// relabel the vertices of a crossing graph with reverse Cuthill-McKee
+// each connected component is walked breadth first starting at its
+// lowest degree vertex, visiting neighbors in order of increasing degree
+// the reversed walk keeps the adjacency lists of crossing segments
+// close together in memory during triangle enumeration
+void reorder_crossing_graph(crossing_graph& graph)
+{
+    const int num_line_segments = static_cast<int>(graph.adjacency.size());
+
+    auto by_degree = [&graph](const int a, const int b)
+    {
+        return graph.adjacency[a].size() < graph.adjacency[b].size();
+    };
+
+    vector<int> starts(num_line_segments);
+    for (auto i = 0; i < num_line_segments; ++i)
+        starts[i] = i;
+    stable_sort(starts.begin(), starts.end(), by_degree);
 
-                if (!find_point(intersects[j], intersect_pt))
-                    intersects[j].push_back(intersect_pt);
+    vector<int> walk;
+    vector<bool> visited(num_line_segments, false);
+    vector<int> neighbors;
+    walk.reserve(num_line_segments);
+    for (const auto start : starts)
+    {
+        if (visited[start])
+            continue;
+
+        visited[start] = true;
+        walk.push_back(start);
+        for (auto head = walk.size() - 1; head < walk.size(); ++head)
+        {
+            neighbors.clear();
+            for (const auto& edge : graph.adjacency[walk[head]])
+            {
+                if (!visited[edge.segment])
+                {
+                    visited[edge.segment] = true;
+                    neighbors.push_back(edge.segment);
+                }
             }
+            stable_sort(neighbors.begin(), neighbors.end(), by_degree);
+            walk.insert(walk.end(), neighbors.begin(), neighbors.end());
+        }
+    }
+    reverse(walk.begin(), walk.end());
+
+    // walk[new label] = old label
+    vector<int> relabel(num_line_segments);
+    for (auto i = 0; i < num_line_segments; ++i)
+        relabel[walk[i]] = i;
+
+    crossing_graph reordered;
+    reordered.adjacency.resize(num_line_segments);
+    reordered.labels.resize(num_line_segments);
+    for (auto i = 0; i < num_line_segments; ++i)
+    {
+        const auto old_label = walk[i];
+        reordered.labels[i] = graph.labels[old_label];
+
+        auto& edges = reordered.adjacency[i];
+        edges.reserve(graph.adjacency[old_label].size());
+        for (const auto& edge : graph.adjacency[old_label])
+        {
+            edges.push_back(edge);
+            edges.back().segment = relabel[edge.segment];
         }
+        sort(edges.begin(), edges.end(), [](const crossing& a, const crossing& b) { return a.segment < b.segment; });
     }
+    graph = move(reordered);
+}
+
+// calculate the triangles of a crossing graph
+// the points are output in the order of the original segment indices
+// the same as calc_triangles given the intersections
+void calc_triangles(const crossing_graph& graph, vector<triangle>& triangles, const triangle_filter& filter)
+{
+    visit_triangles(graph, 0, static_cast<int>(graph.adjacency.size()), filter,
+        [&triangles](int, int, int, const point& p1, const point& p2, const point& p3)
+        {
+            triangles.emplace_back(p1, p2, p3);
+        });
 }
 
 // calculate the triangles with the intersections of line segments
 // intersects[0] contains the intersection points for line segment 0
 // intersects[1] contains the intersection points for line segment 1
 // intersects[N] contains the intersection points for line segment N
-void calc_triangles(vector<vector<point>>& intersects, vector<triangle>& triangles)
+// the membership tests use point lists so they run on find_point's vector path
+// the filter is checked as soon as the first 2 points are known
+// and the search for a third segment is skipped when it cannot be met
+void calc_triangles(vector<vector<point>>& intersects, vector<triangle>& triangles, const triangle_filter& filter)
 {
+    vector<point_list> lists;
+    to_point_lists(intersects, lists);
+
     const int num_line_segments = static_cast<int>(intersects.size());
     for (auto segment_one_index = 0; segment_one_index < num_line_segments - 2; ++segment_one_index)
     {
@@ -184,22 +939,23 @@ void calc_triangles(vector<vector<point>>& intersects, vector<triangle>& triangl
         {
             for (auto segment_two_index = segment_one_index + 1; segment_two_index < num_line_segments - 1; ++segment_two_index)
             {
-                if (!find_point(intersects[segment_two_index], start_point))
+                if (!find_point(lists[segment_two_index], start_point))
                     continue;
 
                 for (point& middle_point : intersects[segment_two_index])
                 {
-                    if (middle_point == start_point)
+                    if (middle_point == start_point || !can_meet(filter, start_point, middle_point))
                         continue;
 
                     for (auto segment_three_index = segment_two_index + 1; segment_three_index < num_line_segments; ++segment_three_index)
                     {
-                        if (!find_point(intersects[segment_three_index], middle_point))
+                        if (!find_point(lists[segment_three_index], middle_point))
                             continue;
 
                         for (point& last_point : intersects[segment_three_index])
                         {
-                            if (last_point == middle_point || !find_point(intersects[segment_one_index], last_point))
+                            if (last_point == middle_point || !find_point(lists[segment_one_index], last_point) ||
+                                !meets(filter, start_point, middle_point, last_point))
                                 continue;
 
                             triangles.emplace_back(start_point, middle_point, last_point);
@@ -211,62 +967,1503 @@ void calc_triangles(vector<vector<point>>& intersects, vector<triangle>& triangl
     }
 }
 
-// calculate the triangles with the intersections of line segments
-// calculate the intersection point for the segments
-// calculate the triangles given the intersection points
-int calc_triangles(const vector<line_segment>& segments, vector<triangle>& triangles)
+// prepare the crossing graph of line segments for triangle enumeration
+// filter NaN, Inf, zero length and duplicate segments from the input
+// merge collinear segments that overlap so each line is only counted once
+// calculate the crossing graph for the segments
+// relabel the graph so crossing segments are close together
+// graph.labels are indices into the merged segments, not the input
+// mapping[N] will output the merged index of segments[N]
+// a duplicate gets the index of the segment it repeats
+// and the other segments filtered from the input get -1
+void prepare_crossing_graph(const segment_view& segments, crossing_graph& graph, vector<int>& mapping, const intersection_kernel kernel,
+    const atomic<bool>* cancel)
 {
-    vector<vector<point>> intersects;
-    intersects.resize(segments.size());
+    vector<line_segment> filtered;
+    filter_report report;
+    filter_degenerate_segments(segments, filtered, report);
 
-    calc_intersections(segments, intersects);
-    calc_triangles(intersects, triangles);
-    return static_cast<int>(triangles.size());
+    vector<line_segment> merged;
+    vector<int> merged_mapping;
+    merge_collinear_segments(filtered, merged, merged_mapping);
+
+    mapping.assign(segments.size(), -1);
+    for (size_t i = 0; i < report.kept.size(); ++i)
+        mapping[report.kept[i]] = merged_mapping[i];
+    for (size_t i = 0; i < report.duplicates.size(); ++i)
+        mapping[report.duplicates[i]] = mapping[report.duplicate_of[i]];
+
+    calc_crossing_graph(merged, graph, kernel, cancel);
+    reorder_crossing_graph(graph);
 }
 
-// main entry point
-// create line segments
-// calculate the triangles
-// output results
-int main()
+// prepare the crossing graph of line segments for triangle enumeration
+// when the mapping back to the input is not needed
+void prepare_crossing_graph(const segment_view& segments, crossing_graph& graph, const intersection_kernel kernel,
+    const atomic<bool>* cancel)
 {
-    vector<triangle> triangles;
-    const vector<line_segment> line_segments =
-    {
-        line_segment(5, 1, 9, 9),
-        line_segment(4, 3, 7, 9),
-        line_segment(3, 5, 5, 9),
-        line_segment(2, 7, 3, 9),
-
-        line_segment(5, 1, 1, 9),
-        line_segment(6, 3, 3, 9),
-        line_segment(7, 5, 5, 9),
-        line_segment(8, 7, 7, 9),
-
-        line_segment(4, 3, 6, 3),
-        line_segment(3, 5, 7, 5),
-        line_segment(2, 7, 8, 7),
-        line_segment(1, 9, 9, 9),
-    };
+    vector<int> mapping;
+    prepare_crossing_graph(segments, graph, mapping, kernel, cancel);
+}
+
+// calculate the triangles with the intersections of line segments
+// prepare the crossing graph for the segments
+// calculate the triangles given the crossing graph
+// only triangles meeting the filter are output
+int calc_triangles(const segment_view& segments, vector<triangle>& triangles, const triangle_filter& filter, const intersection_kernel kernel)
+{
+    crossing_graph graph;
+    prepare_crossing_graph(segments, graph, kernel);
+    calc_triangles(graph, triangles, filter);
+    return static_cast<int>(triangles.size());
+}
+
+// calculate statistics over the triangles of line segments without storing them
+// each thread adds the triangles it finds to its own stats
+// and the stats of all threads are merged at the end
+// thread_count 0 uses one thread per core
+void calc_triangle_stats(const segment_view& segments, const stats_config& config, triangle_stats& stats,
+    int thread_count, const triangle_filter& filter)
+{
+    crossing_graph graph;
+    prepare_crossing_graph(segments, graph);
+
+    if (thread_count <= 0)
+        thread_count = max(1, static_cast<int>(thread::hardware_concurrency()));
+
+    vector<triangle_stats> thread_stats(thread_count, triangle_stats(config));
+    run_in_chunks(static_cast<int>(graph.adjacency.size()), thread_count, [&](const int worker, const int first, const int last)
+    {
+        auto& local = thread_stats[worker];
+        visit_triangles(graph, first, last, filter, [&config, &local](int, int, int, const point& p1, const point& p2, const point& p3)
+        {
+            local.add(config, p1, p2, p3);
+        });
+    });
+
+    stats = triangle_stats(config);
+    for (const auto& local : thread_stats)
+        stats.merge(local);
+}
+
+// calculate the number of triangles each line segment is part of
+// without listing the triangles
+// counts[N] will output the number of triangles segments[N] is part of
+// each thread counts into its own vector and the vectors are added at the end
+// duplicates and segments merged into one piece share its count
+// the other segments filtered from the input are part of no triangle
+// thread_count 0 uses one thread per core
+void calc_segment_triangle_counts(const segment_view& segments, vector<long long>& counts,
+    int thread_count, const triangle_filter& filter)
+{
+    crossing_graph graph;
+    vector<int> mapping;
+    prepare_crossing_graph(segments, graph, mapping);
+
+    if (thread_count <= 0)
+        thread_count = max(1, static_cast<int>(thread::hardware_concurrency()));
+
+    const auto num_merged = graph.adjacency.size();
+    vector<vector<long long>> thread_counts(thread_count, vector<long long>(num_merged, 0));
+    run_in_chunks(static_cast<int>(num_merged), thread_count, [&](const int worker, const int first, const int last)
+    {
+        auto& local = thread_counts[worker];
+        visit_triangles(graph, first, last, filter, [&local](const int s1, const int s2, const int s3, const point&, const point&, const point&)
+        {
+            ++local[s1];
+            ++local[s2];
+            ++local[s3];
+        });
+    });
+
+    vector<long long> merged_counts(num_merged, 0);
+    for (const auto& local : thread_counts)
+        for (size_t i = 0; i < num_merged; ++i)
+            merged_counts[i] += local[i];
+
+    counts.assign(segments.size(), 0);
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        if (mapping[i] >= 0)
+            counts[i] = merged_counts[mapping[i]];
+    }
+}
+
+// prepare a scene of line segments for repeated queries
+void prepare_scene(const segment_view& segments, triangle_scene& scene)
+{
+    prepare_crossing_graph(segments, scene.graph, scene.mapping);
+
+    scene.vertex.assign(scene.graph.labels.size(), -1);
+    for (auto v = 0; v < static_cast<int>(scene.graph.labels.size()); ++v)
+        scene.vertex[scene.graph.labels[v]] = v;
+}
+
+// calculate the triangles a single line segment is part of
+// given a prepared scene and the index of the segment in the input
+// only the crossings of the segment and of the segments it crosses are read
+// each crossing segment is merged with the list of the segment
+// to find the third segments crossing both
+// the triangles are output the same as calc_triangles would output them
+// returns the number of triangles found
+int calc_triangles_for_segment(const triangle_scene& scene, const int segment, vector<triangle>& triangles,
+    const triangle_filter& filter)
+{
+    if (segment < 0 || segment >= static_cast<int>(scene.mapping.size()) || scene.mapping[segment] < 0)
+        return 0;
+
+    const auto& graph = scene.graph;
+    const auto one = scene.vertex[scene.mapping[segment]];
+    const auto& edges_one = graph.adjacency[one];
+    const auto first = triangles.size();
+    auto emit = [&triangles](int, int, int, const point& p1, const point& p2, const point& p3)
+    {
+        triangles.emplace_back(p1, p2, p3);
+    };
+
+    for (auto edge_two = edges_one.begin(); edge_two != edges_one.end(); ++edge_two)
+    {
+        if (!can_meet(filter, edge_two->pt))
+            continue;
+
+        // the third segment comes after the second in both lists
+        // so each triangle is only found once
+        const auto two = edge_two->segment;
+        const auto& edges_two = graph.adjacency[two];
+        auto edge_one = edge_two + 1;
+        auto edge_three = upper_bound(edges_two.begin(), edges_two.end(), two,
+            [](const int value, const crossing& edge) { return value < edge.segment; });
+        while (edge_one != edges_one.end() && edge_three != edges_two.end())
+        {
+            if (edge_one->segment < edge_three->segment)
+            {
+                ++edge_one;
+                continue;
+            }
+            if (edge_three->segment < edge_one->segment)
+            {
+                ++edge_three;
+                continue;
+            }
+
+            const auto& point_12 = edge_two->pt;
+            const auto& point_23 = edge_three->pt;
+            const auto& point_31 = edge_one->pt;
+            if (!(edge_two->vertex == edge_three->vertex || edge_three->vertex == edge_one->vertex || edge_one->vertex == edge_two->vertex) &&
+                meets(filter, point_12, point_23, point_31))
+            {
+                visit_in_order(graph, one, two, edge_one->segment, point_12, point_23, point_31, emit);
+            }
+            ++edge_one;
+            ++edge_three;
+        }
+    }
+    return static_cast<int>(triangles.size() - first);
+}
+
+// estimate the number of triangles of a crossing graph by wedge sampling
+// a wedge is a segment with 2 of the segments crossing it
+// a wedge is closed when those 2 segments also cross at a third point
+// every triangle closes exactly 3 wedges so
+// triangles = closed fraction * wedges / 3
+// wedges are picked at random by choosing a segment weighted by its
+// number of wedges and then 2 of its crossings
+// the number of samples comes from the Hoeffding bound
+// samples = ln(2 / (1 - confidence)) / (2 * error^2)
+// so the time depends on the accuracy and not on the number of triangles
+// error and confidence are clamped to their limits first and the
+// samples are capped at max_estimate_samples
+static void sample_wedges(const crossing_graph& graph, const estimate_config& config, triangle_estimate& estimate)
+{
+    // NaN fails every comparison so it falls back to the default
+    const estimate_config defaults;
+    const auto error = config.error == config.error ?
+        min(max(config.error, min_estimate_error), max_estimate_error) : defaults.error;
+    const auto confidence = config.confidence == config.confidence ?
+        min(max(config.confidence, min_estimate_confidence), max_estimate_confidence) : defaults.confidence;
+
+    const int num_line_segments = static_cast<int>(graph.adjacency.size());
+
+    // wedge_end[N] is the number of wedges of the segments up to and including N
+    vector<long long> wedge_end(num_line_segments);
+    long long wedges = 0;
+    for (auto v = 0; v < num_line_segments; ++v)
+    {
+        const auto degree = static_cast<long long>(graph.adjacency[v].size());
+        wedges += degree * (degree - 1) / 2;
+        wedge_end[v] = wedges;
+    }
+
+    estimate = triangle_estimate();
+    estimate.confidence = confidence;
+    estimate.wedges = static_cast<double>(wedges);
+    if (wedges == 0)
+        return;
+
+    const auto bound = ceil(log(2 / (1 - confidence)) / (2 * error * error));
+    const auto samples = static_cast<long long>(min(bound, static_cast<double>(max_estimate_samples)));
+    mt19937_64 random(config.seed);
+    uniform_int_distribution<long long> pick_wedge(0, wedges - 1);
+
+    long long closed = 0;
+    for (long long sample = 0; sample < samples; ++sample)
+    {
+        // the wedge index is below wedges so the segment found has at least 2 crossings
+        const auto one = upper_bound(wedge_end.begin(), wedge_end.end(), pick_wedge(random)) - wedge_end.begin();
+        const auto& edges_one = graph.adjacency[one];
+        const auto degree = static_cast<int>(edges_one.size());
+
+        // pick 2 different crossings of the segment
+        const auto first = uniform_int_distribution<int>(0, degree - 1)(random);
+        auto second = uniform_int_distribution<int>(0, degree - 2)(random);
+        if (second >= first)
+            ++second;
+
+        const auto& edge_two = edges_one[first];
+        const auto& edge_three = edges_one[second];
+        const auto& edges_two = graph.adjacency[edge_two.segment];
+        const auto found = lower_bound(edges_two.begin(), edges_two.end(), edge_three.segment,
+            [](const crossing& edge, const int value) { return edge.segment < value; });
+        if (found == edges_two.end() || found->segment != edge_three.segment)
+            continue;
+
+        // 3 segments through one vertex do not close the wedge
+        if (!(edge_two.vertex == found->vertex || found->vertex == edge_three.vertex || edge_three.vertex == edge_two.vertex))
+            ++closed;
+    }
+
+    const auto fraction = static_cast<double>(closed) / static_cast<double>(samples);
+    const auto margin = sqrt(log(2 / (1 - confidence)) / (2 * static_cast<double>(samples)));
+    estimate.samples = samples;
+    estimate.count = fraction * estimate.wedges / 3;
+    estimate.low = max(0.0, fraction - margin) * estimate.wedges / 3;
+    estimate.high = min(1.0, fraction + margin) * estimate.wedges / 3;
+}
+
+// estimate the number of triangles of a prepared scene by wedge sampling
+// preparing the scene tests every pair of segments, so when the scene
+// is not needed for anything else use the overload below
+void estimate_triangle_count(const triangle_scene& scene, const estimate_config& config, triangle_estimate& estimate)
+{
+    sample_wedges(scene.graph, config, estimate);
+}
+
+// estimate the number of triangles of line segments by wedge sampling
+// the segments are filtered and merged like prepare_crossing_graph but
+// the crossing graph is built from the pairs of grid_pairs, so the time grows
+// with the number of crossings instead of the number of pairs of segments
+void estimate_triangle_count(const segment_view& segments, const estimate_config& config, triangle_estimate& estimate)
+{
+    vector<line_segment> filtered;
+    filter_report report;
+    filter_degenerate_segments(segments, filtered, report);
+
+    vector<line_segment> merged;
+    vector<int> merged_mapping;
+    merge_collinear_segments(filtered, merged, merged_mapping);
+
+    crossing_graph graph;
+    calc_crossing_graph(merged, grid_pairs(), float_kernel(), hash_dedup(), graph);
+    sample_wedges(graph, config, estimate);
+}
+
+// cluster the crossing points of a fixed calculation into vertices without allocating
+// the same clusters as cluster_crossing_points, the vertex ids are not numbered
+// the point of a crossing is the position of its copy in the list of the lower segment
+// points[N] holds those positions sorted by their tolerance cells and
+// the vertex of that copy is its parent in the clusters until the end
+static void cluster_fixed_crossings(crossing* crossings, const int* offsets, const int num_kept, int* points)
+{
+    auto num_points = 0;
+    for (auto a = 0; a < num_kept; ++a)
+    {
+        for (auto position = offsets[a]; position < offsets[a + 1]; ++position)
+        {
+            if (crossings[position].segment > a)
+            {
+                crossings[position].vertex = position;
+                points[num_points++] = position;
+            }
+        }
+    }
+
+    // the path is halved on the way like point_clusters
+    auto find = [crossings](int position)
+    {
+        while (crossings[position].vertex != position)
+        {
+            crossings[position].vertex = crossings[crossings[position].vertex].vertex;
+            position = crossings[position].vertex;
+        }
+        return position;
+    };
+
+    auto cell_order = [crossings](const int a, const int b)
+    {
+        const auto column_a = calc_tolerance_cell(crossings[a].pt.x);
+        const auto column_b = calc_tolerance_cell(crossings[b].pt.x);
+        if (column_a != column_b)
+            return column_a < column_b;
+        const auto row_a = calc_tolerance_cell(crossings[a].pt.y);
+        const auto row_b = calc_tolerance_cell(crossings[b].pt.y);
+        return row_a != row_b ? row_a < row_b : a < b;
+    };
+    sort(points, points + num_points, cell_order);
+
+    for (auto k = 0; k < num_points; ++k)
+    {
+        const auto position = points[k];
+        const auto& pt = crossings[position].pt;
+        const auto column = calc_tolerance_cell(pt.x);
+        const auto row = calc_tolerance_cell(pt.y);
+        for (auto d_column = -1; d_column <= 1; ++d_column)
+        {
+            for (auto d_row = -1; d_row <= 1; ++d_row)
+            {
+                // only the points after this one are compared, the ones before have compared with it
+                auto in_cell = [&](const int other)
+                {
+                    return calc_tolerance_cell(crossings[other].pt.x) == column + d_column &&
+                        calc_tolerance_cell(crossings[other].pt.y) == row + d_row;
+                };
+                auto before = [&](const int other, const int)
+                {
+                    const auto other_column = calc_tolerance_cell(crossings[other].pt.x);
+                    if (other_column != column + d_column)
+                        return other_column < column + d_column;
+                    const auto other_row = calc_tolerance_cell(crossings[other].pt.y);
+                    return other_row != row + d_row ? other_row < row + d_row : other <= position;
+                };
+                for (auto neighbor = lower_bound(points, points + num_points, 0, before);
+                    neighbor != points + num_points && in_cell(*neighbor); ++neighbor)
+                {
+                    if (crossings[*neighbor].pt == pt)
+                    {
+                        const auto root_a = find(position);
+                        const auto root_b = find(*neighbor);
+                        if (root_a != root_b)
+                            crossings[max(root_a, root_b)].vertex = min(root_a, root_b);
+                    }
+                }
+            }
+        }
+    }
+
+    // the lower copy of each crossing comes first so its root is ready for the higher one
+    for (auto a = 0; a < num_kept; ++a)
+    {
+        for (auto position = offsets[a]; position < offsets[a + 1]; ++position)
+        {
+            auto& edge = crossings[position];
+            if (edge.segment > a)
+            {
+                edge.vertex = find(position);
+                continue;
+            }
+
+            const auto mirror = lower_bound(crossings + offsets[edge.segment], crossings + offsets[edge.segment + 1], a,
+                [](const crossing& other, const int value) { return other.segment < value; });
+            edge.vertex = mirror->vertex;
+        }
+    }
+}
+
+// calculate the triangles of line segments without allocating
+// the kept segments are deduplicated by sorting their indices in place
+// the crossing lists are filled in tiles, sorted in place by the segment
+// crossed and the triangles are found by merging them like visit_triangles
+fixed_status calc_triangles_fixed(const segment_view& segments, fixed_buffers& buffers, const triangle_filter& filter, const intersection_kernel kernel)
+{
+    buffers.segment_count = 0;
+    buffers.vertex_count = 0;
+    buffers.triangle_count = 0;
+    if (buffers.offsets == nullptr || buffers.segment_capacity < 0 || buffers.vertex_capacity < 0 || buffers.triangle_capacity < 0 ||
+        (buffers.kept == nullptr && buffers.segment_capacity > 0) ||
+        ((buffers.crossings == nullptr || buffers.points == nullptr) && buffers.vertex_capacity > 0) ||
+        (buffers.triangles == nullptr && buffers.triangle_capacity > 0))
+    {
+        return fixed_status::invalid_buffers;
+    }
+
+    auto* kept = buffers.kept;
+    auto num_kept = 0;
+    for (auto i = 0; i < static_cast<int>(segments.size()); ++i)
+    {
+        bool finite;
+        bool zero_length;
+        check_segment(segments[i], finite, zero_length);
+        if (!finite || zero_length)
+            continue;
+
+        if (num_kept == buffers.segment_capacity)
+            return fixed_status::segment_overflow;
+        kept[num_kept++] = i;
+    }
+
+    // equal segments sort next to each other with the first input index leading
+    auto by_key = [&segments](const int a, const int b)
+    {
+        const auto order = memcmp(segment_key(segments[a]).bits, segment_key(segments[b]).bits, sizeof(segment_key::bits));
+        return order < 0 || (order == 0 && a < b);
+    };
+    sort(kept, kept + num_kept, by_key);
+    auto num_unique = 0;
+    for (auto k = 0; k < num_kept; ++k)
+    {
+        if (num_unique == 0 || !(segment_key(segments[kept[k]]) == segment_key(segments[kept[num_unique - 1]])))
+            kept[num_unique++] = kept[k];
+    }
+    num_kept = num_unique;
+    sort(kept, kept + num_kept);
+    buffers.segment_count = num_kept;
+
+    // count the crossings of each segment in offsets[N + 1]
+    // kept is in input order so a < b keeps the rounding of calc_intersections
+    auto* offsets = buffers.offsets;
+    fill(offsets, offsets + num_kept + 1, 0);
+    long long num_vertices = 0;
+    select_intersection_kernel(kernel, [&](auto intersect)
+    {
+        visit_intersections(num_kept,
+            [&](const int a, const int b, point& pt) { return intersect(segments[kept[a]], segments[kept[b]], pt); },
+            [&](const int a, const int b, const point&)
+            {
+                ++offsets[a + 1];
+                ++offsets[b + 1];
+                ++num_vertices;
+            });
+    });
+    if (num_vertices > buffers.vertex_capacity)
+        return fixed_status::vertex_overflow;
+    buffers.vertex_count = static_cast<int>(num_vertices);
+
+    // offsets[N + 1] is moved to the start of segment N and used as its fill position
+    // so once filled it ends up at the end of segment N, the start of segment N + 1
+    auto start = 0;
+    for (auto a = 0; a < num_kept; ++a)
+    {
+        const auto count = offsets[a + 1];
+        offsets[a + 1] = start;
+        start += count;
+    }
+
+    auto* crossings = buffers.crossings;
+    select_intersection_kernel(kernel, [&](auto intersect)
+    {
+        visit_intersections(num_kept,
+            [&](const int a, const int b, point& pt) { return intersect(segments[kept[a]], segments[kept[b]], pt); },
+            [&](const int a, const int b, const point& pt)
+            {
+                crossings[offsets[a + 1]++] = crossing(b, pt);
+                crossings[offsets[b + 1]++] = crossing(a, pt);
+            });
+    });
+
+    // the tiles do not fill a segment in order of the other segment
+    for (auto a = 0; a < num_kept; ++a)
+        sort(crossings + offsets[a], crossings + offsets[a + 1], [](const crossing& x, const crossing& y) { return x.segment < y.segment; });
+
+    cluster_fixed_crossings(crossings, offsets, num_kept, buffers.points);
+
+    auto overflow = false;
+    auto emit = [&buffers, &overflow](int, int, int, const point& p1, const point& p2, const point& p3)
+    {
+        if (buffers.triangle_count == buffers.triangle_capacity)
+        {
+            overflow = true;
+            return;
+        }
+        buffers.triangles[buffers.triangle_count++] = triangle(p1, p2, p3);
+    };
+
+    auto after = [crossings](const int first, const int last, const int segment)
+    {
+        return static_cast<int>(upper_bound(crossings + first, crossings + last, segment,
+            [](const int value, const crossing& edge) { return value < edge.segment; }) - crossings);
+    };
+
+    for (auto one = 0; one < num_kept && !overflow; ++one)
+    {
+        const auto end_one = offsets[one + 1];
+        for (auto edge_two = after(offsets[one], end_one, one); edge_two < end_one && !overflow; ++edge_two)
+        {
+            if (!can_meet(filter, crossings[edge_two].pt))
+                continue;
+
+            const auto two = crossings[edge_two].segment;
+            const auto end_two = offsets[two + 1];
+            auto edge_one = edge_two + 1;
+            auto edge_three = after(offsets[two], end_two, two);
+            while (edge_one < end_one && edge_three < end_two)
+            {
+                if (crossings[edge_one].segment < crossings[edge_three].segment)
+                {
+                    ++edge_one;
+                    continue;
+                }
+                if (crossings[edge_three].segment < crossings[edge_one].segment)
+                {
+                    ++edge_three;
+                    continue;
+                }
+
+                // point_ab is where segments a and b cross
+                const auto& point_12 = crossings[edge_two].pt;
+                const auto& point_23 = crossings[edge_three].pt;
+                const auto& point_31 = crossings[edge_one].pt;
+                if (!(crossings[edge_two].vertex == crossings[edge_three].vertex ||
+                    crossings[edge_three].vertex == crossings[edge_one].vertex ||
+                    crossings[edge_one].vertex == crossings[edge_two].vertex) &&
+                    meets(filter, point_12, point_23, point_31))
+                {
+                    visit_in_order(kept, one, two, crossings[edge_one].segment, point_12, point_23, point_31, emit);
+                }
+                ++edge_one;
+                ++edge_three;
+            }
+        }
+    }
+    return overflow ? fixed_status::triangle_overflow : fixed_status::ok;
+}
+
+// add a crossing point to growing vertex clusters
+// the cells are hashed from their 2 indices, cells that share a key
+// only cost time because the points in them are still compared
+int add_vertex_point(vertex_clusters& vertices, const point& pt)
+{
+    auto cell_key = [](const long long column, const long long row)
+    {
+        return static_cast<uint64_t>(column) * 0x9e3779b97f4a7c15ull ^ static_cast<uint64_t>(row);
+    };
+
+    const auto index = vertices.clusters.add();
+    vertices.points.push_back(pt);
+    const auto column = calc_tolerance_cell(pt.x);
+    const auto row = calc_tolerance_cell(pt.y);
+    for (auto d_column = -1; d_column <= 1; ++d_column)
+    {
+        for (auto d_row = -1; d_row <= 1; ++d_row)
+        {
+            const auto found = vertices.cells.find(cell_key(column + d_column, row + d_row));
+            if (found == vertices.cells.end())
+                continue;
+            for (const auto other : found->second)
+            {
+                if (vertices.points[other] == pt)
+                    vertices.clusters.merge(index, other);
+            }
+        }
+    }
+    vertices.cells[cell_key(column, row)].push_back(index);
+    return index;
+}
+
+// determine if a new line segment should be kept by a stream
+// the same tests as filter_degenerate_segments
+// seen holds the segments kept so far
+bool keep_segment(unordered_map<segment_key, int, segment_key_hash>& seen, const line_segment& segment, const int input_index)
+{
+    bool finite;
+    bool zero_length;
+    check_segment(segment, finite, zero_length);
+    return finite && !zero_length && seen.emplace(segment_key(segment), input_index).second;
+}
+
+// add a line segment to the cells of an incremental grid its bounding box overlaps
+static void insert_grid_segment(incremental_grid& grid, const vector<line_segment>& segments, const int index)
+{
+    int first_column, first_row, last_column, last_row;
+    calc_cell_range(grid.bounds, grid.columns, grid.rows, calc_bounds(segments[index]), first_column, first_row, last_column, last_row);
+    for (auto row = first_row; row <= last_row; ++row)
+        for (auto column = first_column; column <= last_column; ++column)
+            grid.cells[row * grid.columns + column].push_back(index);
+}
+
+// rebuild an incremental grid over all its line segments
+// the bounds of the segments are padded by half their size on each side
+// and kept inside the float range, with about one cell for every 2 segments
+static void rebuild_incremental_grid(incremental_grid& grid, const vector<line_segment>& segments)
+{
+    auto bounds = calc_bounds(segments[0]);
+    for (const auto& segment : segments)
+    {
+        const auto segment_bounds = calc_bounds(segment);
+        bounds.min_x = min(bounds.min_x, segment_bounds.min_x);
+        bounds.min_y = min(bounds.min_y, segment_bounds.min_y);
+        bounds.max_x = max(bounds.max_x, segment_bounds.max_x);
+        bounds.max_y = max(bounds.max_y, segment_bounds.max_y);
+    }
+
+    const auto limit = static_cast<double>(numeric_limits<float>::max());
+    const auto pad = max(static_cast<double>(bounds.max_x) - bounds.min_x, static_cast<double>(bounds.max_y) - bounds.min_y) / 2;
+    auto padded = [limit](const double value) { return static_cast<float>(max(-limit, min(limit, value))); };
+    grid.bounds = rect(padded(bounds.min_x - pad), padded(bounds.min_y - pad), padded(bounds.max_x + pad), padded(bounds.max_y + pad));
+
+    const auto side = max(1, static_cast<int>(sqrt(static_cast<double>(segments.size()) / 2)));
+    grid.columns = side;
+    grid.rows = side;
+    grid.rebuild_size = 2 * segments.size();
+    grid.cells.clear();
+    grid.cells.resize(static_cast<size_t>(side) * side);
+    for (auto i = 0; i < static_cast<int>(segments.size()); ++i)
+        insert_grid_segment(grid, segments, i);
+}
+
+// add the last of the line segments to an incremental grid
+// the grid is rebuilt over all the segments when needed
+// so adding a segment takes amortized constant time
+void add_grid_segment(incremental_grid& grid, const vector<line_segment>& segments)
+{
+    const auto index = static_cast<int>(segments.size()) - 1;
+    const auto& segment = segments[index];
+    if (segments.size() > grid.rebuild_size || !grid.bounds.contains(segment.p1) || !grid.bounds.contains(segment.p2))
+        rebuild_incremental_grid(grid, segments);
+    else
+        insert_grid_segment(grid, segments, index);
+}
+
+// find the line segments of an incremental grid whose bounding box overlaps a rectangle
+// output the indices of the segments in candidates sorted and without duplicates
+void query_incremental_grid(const incremental_grid& grid, const vector<line_segment>& segments, const rect& area,
+    vector<int>& candidates)
+{
+    candidates.clear();
+    if (grid.columns == 0 || !grid.bounds.overlaps(area))
+        return;
+
+    int first_column, first_row, last_column, last_row;
+    calc_cell_range(grid.bounds, grid.columns, grid.rows, area, first_column, first_row, last_column, last_row);
+    for (auto row = first_row; row <= last_row; ++row)
+    {
+        for (auto column = first_column; column <= last_column; ++column)
+        {
+            for (const auto index : grid.cells[row * grid.columns + column])
+            {
+                if (calc_bounds(segments[index]).overlaps(area))
+                    candidates.push_back(index);
+            }
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+}
+
+// calculate the crossings of a new line segment
+// with the segments kept before it, given the grid they were added to
+// only the segments whose bounding box overlaps the new one are tested
+// the new segment goes second so the points are rounded the same as calc_intersections
+// the crossings are sorted by segment
+void calc_new_crossings(const vector<line_segment>& segments, const incremental_grid& grid, const line_segment& segment,
+    vector<crossing>& crossings)
+{
+    // the box is padded by a small part of the largest coordinate
+    // so a pair that only crosses through rounding is still tested
+    auto area = calc_bounds(segment);
+    const auto magnitude = max(max(max(abs(grid.bounds.min_x), abs(grid.bounds.max_x)), max(abs(grid.bounds.min_y), abs(grid.bounds.max_y))),
+        max(max(abs(area.min_x), abs(area.max_x)), max(abs(area.min_y), abs(area.max_y))));
+    const auto pad = magnitude * 1e-5f + static_cast<float>(compare_tolerance);
+    area = rect(area.min_x - pad, area.min_y - pad, area.max_x + pad, area.max_y + pad);
+
+    vector<int> candidates;
+    query_incremental_grid(grid, segments, area, candidates);
+
+    crossings.clear();
+    for (const auto i : candidates)
+    {
+        point intersect_pt(0, 0);
+        if (calc_intersection(segments[i], segment, intersect_pt))
+            crossings.emplace_back(i, intersect_pt);
+    }
+}
+
+// add a chunk of line segments to a stream
+// the triangles completed by the chunk are appended to triangles
+// returns the number of triangles added
+int add_segments(triangle_stream& stream, const vector<line_segment>& chunk, vector<triangle>& triangles,
+    const triangle_filter& filter)
+{
+    const auto first = triangles.size();
+    add_segments(stream, chunk, filter, [&triangles](int, int, int, const point& p1, const point& p2, const point& p3)
+    {
+        triangles.emplace_back(p1, p2, p3);
+    });
+    return static_cast<int>(triangles.size() - first);
+}
+
+// calculate the geometry of the triangles of a batch
+// from begin up to end one triangle at a time
+void calc_triangle_geometry(triangle_batch& batch, const int begin, const int end)
+{
+    for (auto i = begin; i < end; ++i)
+    {
+        const auto ux = batch.x2[i] - batch.x1[i];
+        const auto uy = batch.y2[i] - batch.y1[i];
+        const auto vx = batch.x3[i] - batch.x1[i];
+        const auto vy = batch.y3[i] - batch.y1[i];
+        const auto wx = batch.x3[i] - batch.x2[i];
+        const auto wy = batch.y3[i] - batch.y2[i];
+
+        batch.area[i] = (ux * vy - uy * vx) * 0.5f;
+        batch.perimeter[i] = sqrt(ux * ux + uy * uy) + sqrt(vx * vx + vy * vy) + sqrt(wx * wx + wy * wy);
+        batch.degenerate[i] = abs(batch.area[i]) <= point_tolerance;
+    }
+}
+
+// calculate the signed area, perimeter and degeneracy of every triangle of a batch
+// a triangle is degenerate when its area is below compare_tolerance
+// the vector lanes and the scalar tail both test abs(area) <= point_tolerance
+// so a triangle gets the same answer wherever it falls in the batch
+// the batch is processed 8 or 4 triangles at a time with vector instructions
+void calc_triangle_geometry(triangle_batch& batch)
+{
+    const auto count = batch.size();
+    batch.area.resize(count);
+    batch.perimeter.resize(count);
+    batch.degenerate.resize(count);
+    auto index = 0;
+
+#if defined(FIND_TRIANGLES_AVX)
+    const auto half = _mm256_set1_ps(0.5f);
+    const auto sign = _mm256_set1_ps(-0.0f);
+    const auto tolerance = _mm256_set1_ps(point_tolerance);
+    for (; index + 8 <= count; index += 8)
+    {
+        const auto x1 = _mm256_loadu_ps(batch.x1.data() + index);
+        const auto y1 = _mm256_loadu_ps(batch.y1.data() + index);
+        const auto x2 = _mm256_loadu_ps(batch.x2.data() + index);
+        const auto y2 = _mm256_loadu_ps(batch.y2.data() + index);
+        const auto x3 = _mm256_loadu_ps(batch.x3.data() + index);
+        const auto y3 = _mm256_loadu_ps(batch.y3.data() + index);
+
+        const auto ux = _mm256_sub_ps(x2, x1);
+        const auto uy = _mm256_sub_ps(y2, y1);
+        const auto vx = _mm256_sub_ps(x3, x1);
+        const auto vy = _mm256_sub_ps(y3, y1);
+        const auto wx = _mm256_sub_ps(x3, x2);
+        const auto wy = _mm256_sub_ps(y3, y2);
+
+        const auto area = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(ux, vy), _mm256_mul_ps(uy, vx)), half);
+        const auto perimeter = _mm256_add_ps(_mm256_add_ps(
+            _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(ux, ux), _mm256_mul_ps(uy, uy))),
+            _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)))),
+            _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(wx, wx), _mm256_mul_ps(wy, wy))));
+        const auto degenerate = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, area), tolerance, _CMP_LE_OQ));
+
+        _mm256_storeu_ps(batch.area.data() + index, area);
+        _mm256_storeu_ps(batch.perimeter.data() + index, perimeter);
+        for (auto lane = 0; lane < 8; ++lane)
+            batch.degenerate[index + lane] = (degenerate >> lane) & 1;
+    }
+#elif defined(FIND_TRIANGLES_SSE2)
+    const auto half = _mm_set1_ps(0.5f);
+    const auto sign = _mm_set1_ps(-0.0f);
+    const auto tolerance = _mm_set1_ps(point_tolerance);
+    for (; index + 4 <= count; index += 4)
+    {
+        const auto x1 = _mm_loadu_ps(batch.x1.data() + index);
+        const auto y1 = _mm_loadu_ps(batch.y1.data() + index);
+        const auto x2 = _mm_loadu_ps(batch.x2.data() + index);
+        const auto y2 = _mm_loadu_ps(batch.y2.data() + index);
+        const auto x3 = _mm_loadu_ps(batch.x3.data() + index);
+        const auto y3 = _mm_loadu_ps(batch.y3.data() + index);
+
+        const auto ux = _mm_sub_ps(x2, x1);
+        const auto uy = _mm_sub_ps(y2, y1);
+        const auto vx = _mm_sub_ps(x3, x1);
+        const auto vy = _mm_sub_ps(y3, y1);
+        const auto wx = _mm_sub_ps(x3, x2);
+        const auto wy = _mm_sub_ps(y3, y2);
+
+        const auto area = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(ux, vy), _mm_mul_ps(uy, vx)), half);
+        const auto perimeter = _mm_add_ps(_mm_add_ps(
+            _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ux, ux), _mm_mul_ps(uy, uy))),
+            _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)))),
+            _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(wx, wx), _mm_mul_ps(wy, wy))));
+        const auto degenerate = _mm_movemask_ps(_mm_cmple_ps(_mm_andnot_ps(sign, area), tolerance));
+
+        _mm_storeu_ps(batch.area.data() + index, area);
+        _mm_storeu_ps(batch.perimeter.data() + index, perimeter);
+        for (auto lane = 0; lane < 4; ++lane)
+            batch.degenerate[index + lane] = (degenerate >> lane) & 1;
+    }
+#endif
+
+    calc_triangle_geometry(batch, index, count);
+}
+
+// remove the degenerate triangles from a vector of triangles
+// the geometry is calculated for the whole vector as one batch
+// and the triangles that are kept are moved down in a single pass
+// returns the number of triangles removed
+int remove_degenerate_triangles(vector<triangle>& triangles)
+{
+    triangle_batch batch(triangles);
+    calc_triangle_geometry(batch);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < triangles.size(); ++i)
+    {
+        if (!batch.degenerate[i])
+            triangles[kept++] = triangles[i];
+    }
+
+    const auto removed = static_cast<int>(triangles.size() - kept);
+    triangles.erase(triangles.begin() + kept, triangles.end());
+    return removed;
+}
+
+// calculate the bounding box of a line segment
+rect calc_bounds(const line_segment& segment)
+{
+    return rect(min(segment.p1.x, segment.p2.x), min(segment.p1.y, segment.p2.y),
+        max(segment.p1.x, segment.p2.x), max(segment.p1.y, segment.p2.y));
+}
+
+// calculate the range of cells covered by a rectangle
+// given the bounds and the number of columns and rows of a grid
+// the range is clamped to the grid
+void calc_cell_range(const rect& bounds, const int columns, const int rows, const rect& area,
+    int& first_column, int& first_row, int& last_column, int& last_row)
+{
+    const auto width = static_cast<double>(bounds.max_x) - bounds.min_x;
+    const auto height = static_cast<double>(bounds.max_y) - bounds.min_y;
+    // the index is clamped before converting so huge coordinates cannot overflow
+    auto cell = [](const double value, const double low, const double extent, const int count)
+    {
+        if (extent <= 0)
+            return 0;
+        const auto index = (value - low) / extent * count;
+        return static_cast<int>(max(0.0, min(count - 1.0, index)));
+    };
+
+    first_column = cell(area.min_x, bounds.min_x, width, columns);
+    last_column = cell(area.max_x, bounds.min_x, width, columns);
+    first_row = cell(area.min_y, bounds.min_y, height, rows);
+    last_row = cell(area.max_y, bounds.min_y, height, rows);
+}
+
+// calculate the range of grid cells covered by a rectangle
+// the range is clamped to the grid
+void calc_cell_range(const segment_grid& grid, const rect& area, int& first_column, int& first_row, int& last_column, int& last_row)
+{
+    calc_cell_range(grid.bounds, grid.columns, grid.rows, area, first_column, first_row, last_column, last_row);
+}
+
+// build a uniform grid over line segments
+// the grid has about one cell per segment
+// every segment is added to each cell its bounding box overlaps
+void build_segment_grid(const segment_view& segments, segment_grid& grid)
+{
+    grid = segment_grid();
+    if (segments.empty())
+        return;
+
+    grid.bounds = calc_bounds(segments[0]);
+    for (const auto& segment : segments)
+    {
+        const auto bounds = calc_bounds(segment);
+        grid.bounds.min_x = min(grid.bounds.min_x, bounds.min_x);
+        grid.bounds.min_y = min(grid.bounds.min_y, bounds.min_y);
+        grid.bounds.max_x = max(grid.bounds.max_x, bounds.max_x);
+        grid.bounds.max_y = max(grid.bounds.max_y, bounds.max_y);
+    }
+
+    const auto side = max(1, static_cast<int>(sqrt(static_cast<double>(segments.size()))));
+    grid.columns = side;
+    grid.rows = side;
+
+    // count the segments in each cell then place them
+    grid.cell_start.assign(static_cast<size_t>(side) * side + 1, 0);
+    for (const auto& segment : segments)
+    {
+        int first_column, first_row, last_column, last_row;
+        calc_cell_range(grid, calc_bounds(segment), first_column, first_row, last_column, last_row);
+        for (auto row = first_row; row <= last_row; ++row)
+            for (auto column = first_column; column <= last_column; ++column)
+                ++grid.cell_start[row * side + column + 1];
+    }
+    for (size_t cell = 1; cell < grid.cell_start.size(); ++cell)
+        grid.cell_start[cell] += grid.cell_start[cell - 1];
+
+    grid.indices.resize(grid.cell_start.back());
+    vector<int> fill(grid.cell_start.begin(), grid.cell_start.end() - 1);
+    for (auto i = 0; i < static_cast<int>(segments.size()); ++i)
+    {
+        int first_column, first_row, last_column, last_row;
+        calc_cell_range(grid, calc_bounds(segments[i]), first_column, first_row, last_column, last_row);
+        for (auto row = first_row; row <= last_row; ++row)
+            for (auto column = first_column; column <= last_column; ++column)
+                grid.indices[fill[row * side + column]++] = i;
+    }
+}
+
+// find the line segments whose bounding box overlaps a rectangle
+// given the grid built over the segments
+// output the indices of the segments in candidates sorted and without duplicates
+void query_segment_grid(const segment_grid& grid, const segment_view& segments, const rect& area, vector<int>& candidates)
+{
+    candidates.clear();
+    if (grid.columns == 0 || !grid.bounds.overlaps(area))
+        return;
+
+    int first_column, first_row, last_column, last_row;
+    calc_cell_range(grid, area, first_column, first_row, last_column, last_row);
+    for (auto row = first_row; row <= last_row; ++row)
+    {
+        for (auto column = first_column; column <= last_column; ++column)
+        {
+            const auto cell = row * grid.columns + column;
+            for (auto k = grid.cell_start[cell]; k < grid.cell_start[cell + 1]; ++k)
+            {
+                if (calc_bounds(segments[grid.indices[k]]).overlaps(area))
+                    candidates.push_back(grid.indices[k]);
+            }
+        }
+    }
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+}
+
+// clip a line segment to a rectangle
+// from https://en.wikipedia.org/wiki/Liang%E2%80%93Barsky_algorithm
+// if part of the segment is inside the rectangle return it in clipped
+bool clip_segment(const line_segment& segment, const rect& area, line_segment& clipped)
+{
+    const auto x1 = static_cast<double>(segment.p1.x);
+    const auto y1 = static_cast<double>(segment.p1.y);
+    const auto dx = static_cast<double>(segment.p2.x) - x1;
+    const auto dy = static_cast<double>(segment.p2.y) - y1;
+
+    // p is the direction against each edge and q the distance inside it
+    const double p[4] = { -dx, dx, -dy, dy };
+    const double q[4] = { x1 - area.min_x, area.max_x - x1, y1 - area.min_y, area.max_y - y1 };
+
+    auto t0 = 0.0;
+    auto t1 = 1.0;
+    for (auto edge = 0; edge < 4; ++edge)
+    {
+        if (p[edge] == 0)
+        {
+            if (q[edge] < 0)
+                return false;
+            continue;
+        }
+
+        const auto t = q[edge] / p[edge];
+        if (p[edge] < 0)
+            t0 = max(t0, t);
+        else
+            t1 = min(t1, t);
+    }
+    if (t0 > t1)
+        return false;
+
+    // keep the original end points when they are inside so they are not rounded
+    clipped = line_segment(
+        t0 == 0 ? segment.p1 : point(static_cast<float>(x1 + t0 * dx), static_cast<float>(y1 + t0 * dy)),
+        t1 == 1 ? segment.p2 : point(static_cast<float>(x1 + t1 * dx), static_cast<float>(y1 + t1 * dy)));
+    return true;
+}
+
+// calculate the triangles inside a rectangle
+// given the line segments and the grid built over them
+// the segments overlapping the rectangle are found with the grid
+// and clipped to it before calculating the triangles
+// only triangles with all 3 points inside the rectangle are output
+// the points are calculated from the clipped segments so they can
+// differ from calc_triangles over the whole scene by rounding
+int calc_triangles_in_rect(const segment_view& segments, const segment_grid& grid, const rect& area, vector<triangle>& triangles)
+{
+    vector<int> candidates;
+    query_segment_grid(grid, segments, area, candidates);
+
+    vector<line_segment> clipped;
+    clipped.reserve(candidates.size());
+    for (const auto index : candidates)
+    {
+        line_segment piece(0, 0, 0, 0);
+        if (clip_segment(segments[index], area, piece))
+            clipped.push_back(piece);
+    }
+
+    triangle_filter filter;
+    filter.bounded = true;
+    filter.bounds = area;
+
+    const auto first = triangles.size();
+    calc_triangles(clipped, triangles, filter);
+    return static_cast<int>(triangles.size() - first);
+}
+
+// calculate the triangles inside a rectangle
+// builds the grid for a single query
+// keep a segment_grid and call the overload above for repeated queries
+int calc_triangles_in_rect(const segment_view& segments, const rect& area, vector<triangle>& triangles)
+{
+    segment_grid grid;
+    build_segment_grid(segments, grid);
+    return calc_triangles_in_rect(segments, grid, area, triangles);
+}
+
+// calculate the bounding box of a triangle
+rect calc_bounds(const triangle& tri)
+{
+    return rect(min({ tri.p1.x, tri.p2.x, tri.p3.x }), min({ tri.p1.y, tri.p2.y, tri.p3.y }),
+        max({ tri.p1.x, tri.p2.x, tri.p3.x }), max({ tri.p1.y, tri.p2.y, tri.p3.y }));
+}
+
+// calculate the smallest rectangle containing 2 rectangles
+rect calc_bounds(const rect& a, const rect& b)
+{
+    return rect(min(a.min_x, b.min_x), min(a.min_y, b.min_y), max(a.max_x, b.max_x), max(a.max_y, b.max_y));
+}
+
+// sort boxes in sort tile recursive order
+// the boxes are sorted by the x of their center and cut into vertical slices
+// each slice is sorted by the y of its center so that every run of
+// index_node_size boxes covers a compact tile
+// order will output the indices of the boxes in that order
+void calc_tile_order(const vector<rect>& boxes, vector<int>& order)
+{
+    const int count = static_cast<int>(boxes.size());
+    order.resize(count);
+    for (auto i = 0; i < count; ++i)
+        order[i] = i;
+
+    auto center_x = [&boxes](const int a, const int b) { return boxes[a].min_x + boxes[a].max_x < boxes[b].min_x + boxes[b].max_x; };
+    auto center_y = [&boxes](const int a, const int b) { return boxes[a].min_y + boxes[a].max_y < boxes[b].min_y + boxes[b].max_y; };
+    sort(order.begin(), order.end(), center_x);
+
+    const auto node_count = (count + index_node_size - 1) / index_node_size;
+    const auto slice_count = static_cast<int>(ceil(sqrt(static_cast<double>(node_count))));
+    const auto slice_size = slice_count * index_node_size;
+    for (auto slice = 0; slice < count; slice += slice_size)
+        sort(order.begin() + slice, order.begin() + min(slice + slice_size, count), center_y);
+}
+
+// pack boxes into the nodes of one level of the triangle index
+// given the boxes in tile order, every run of index_node_size boxes becomes a node
+// the children of a node start at first in the level below
+void pack_level(const vector<rect>& boxes, const vector<int>& order, const int first, vector<index_node>& nodes)
+{
+    for (auto start = 0; start < static_cast<int>(order.size()); start += index_node_size)
+    {
+        const auto count = min(index_node_size, static_cast<int>(order.size()) - start);
+        auto bounds = boxes[order[start]];
+        for (auto k = start + 1; k < start + count; ++k)
+            bounds = calc_bounds(bounds, boxes[order[k]]);
+        nodes.emplace_back(bounds, first + start, count);
+    }
+}
+
+// build a packed R-tree over bounding boxes with sort tile recursive bulk loading
+// the leaves are built over the boxes in tile order
+// every level above is built over the level below in tile order
+// until a single root is left
+void build_box_index(vector<rect> boxes, triangle_index& index)
+{
+    index = triangle_index();
+    if (boxes.empty())
+        return;
+
+    calc_tile_order(boxes, index.items);
+    pack_level(boxes, index.items, 0, index.nodes);
+    index.leaf_count = static_cast<int>(index.nodes.size());
+
+    auto level_start = 0;
+    while (static_cast<int>(index.nodes.size()) - level_start > 1)
+    {
+        // put the level in tile order so the children of each parent are consecutive
+        const auto level_end = static_cast<int>(index.nodes.size());
+        boxes.clear();
+        for (auto i = level_start; i < level_end; ++i)
+            boxes.push_back(index.nodes[i].bounds);
+
+        vector<int> order;
+        calc_tile_order(boxes, order);
+
+        vector<index_node> level;
+        level.reserve(order.size());
+        for (const auto k : order)
+            level.push_back(index.nodes[level_start + k]);
+        copy(level.begin(), level.end(), index.nodes.begin() + level_start);
+
+        for (auto k = 0; k < static_cast<int>(order.size()); ++k)
+        {
+            boxes[k] = level[k].bounds;
+            order[k] = k;
+        }
+        pack_level(boxes, order, level_start, index.nodes);
+        level_start = level_end;
+    }
+}
+
+// build a packed R-tree over triangles
+void build_triangle_index(const vector<triangle>& triangles, triangle_index& index)
+{
+    vector<rect> boxes;
+    boxes.reserve(triangles.size());
+    for (const auto& tri : triangles)
+        boxes.push_back(calc_bounds(tri));
+    build_box_index(move(boxes), index);
+}
+
+// determine if a point is inside a triangle
+// a point on an edge is inside
+bool contains_point(const triangle& tri, const point& pt)
+{
+    auto side = [&pt](const point& a, const point& b)
+    {
+        return (static_cast<double>(b.x) - a.x) * (static_cast<double>(pt.y) - a.y) -
+            (static_cast<double>(b.y) - a.y) * (static_cast<double>(pt.x) - a.x);
+    };
+
+    const auto d1 = side(tri.p1, tri.p2);
+    const auto d2 = side(tri.p2, tri.p3);
+    const auto d3 = side(tri.p3, tri.p1);
+    const auto negative = d1 < 0 || d2 < 0 || d3 < 0;
+    const auto positive = d1 > 0 || d2 > 0 || d3 > 0;
+    return !(negative && positive);
+}
 
-    calc_triangles(line_segments, triangles);
+// determine if a triangle overlaps a rectangle
+// either an edge of the triangle crosses the rectangle
+// or the rectangle is inside the triangle
+bool overlaps(const triangle& tri, const rect& area)
+{
+    line_segment clipped(0, 0, 0, 0);
+    if (clip_segment(line_segment(tri.p1, tri.p2), area, clipped) ||
+        clip_segment(line_segment(tri.p2, tri.p3), area, clipped) ||
+        clip_segment(line_segment(tri.p3, tri.p1), area, clipped))
+        return true;
+
+    return contains_point(tri, point(area.min_x, area.min_y));
+}
+
+// find the triangles containing a point
+// given the triangles and the index built over them
+// output the indices of the triangles in found
+void query_triangles_at(const triangle_index& index, const vector<triangle>& triangles, const point& pt, vector<int>& found)
+{
+    found.clear();
+    visit_triangle_index(index, rect(pt.x, pt.y, pt.x, pt.y), [&](const int item)
+    {
+        if (contains_point(triangles[item], pt))
+            found.push_back(item);
+    });
+}
 
-    cout << "Line segments" << endl;
-    for (const auto& line_segment : line_segments)
+// find the triangles overlapping a rectangle
+// given the triangles and the index built over them
+// output the indices of the triangles in found
+void query_triangles_in(const triangle_index& index, const vector<triangle>& triangles, const rect& area, vector<int>& found)
+{
+    found.clear();
+    visit_triangle_index(index, area, [&](const int item)
     {
-        cout <<
-            "(" << setw(3) << line_segment.p1.x << ", " << setw(3) << line_segment.p1.y << "), " <<
-            "(" << setw(3) << line_segment.p2.x << ", " << setw(3) << line_segment.p2.y << ")" <<
-            endl;
+        if (overlaps(triangles[item], area))
+            found.push_back(item);
+    });
+}
+
+// add a double to a nonoverlapping expansion of increasing magnitude
+// the expansion keeps its properties and zero components are dropped
+// returns the new length of the expansion
+static int grow_expansion(double* expansion, const int length, const double value)
+{
+    auto sum = value;
+    auto grown = 0;
+    for (auto i = 0; i < length; ++i)
+    {
+        // two sum, sum + error is exactly the old sum + expansion[i]
+        const auto total = sum + expansion[i];
+        const auto virtual_part = total - sum;
+        const auto error = (sum - (total - virtual_part)) + (expansion[i] - virtual_part);
+        if (error != 0)
+            expansion[grown++] = error;
+        sum = total;
     }
-    cout << endl << "Triangles" << endl;
-    for (const auto& triangle : triangles)
+    if (sum != 0 || grown == 0)
+        expansion[grown++] = sum;
+    return grown;
+}
+
+// calculate the sign of (a - b) * (c - d) - (e - f) * (g - h) exactly
+// the largest component of the expansion has the sign of the whole sum
+int calc_exact_sign(const float a, const float b, const float c, const float d, const float e, const float f, const float g, const float h)
+{
+    const double terms[8] =
+    {
+        static_cast<double>(a) * c, -static_cast<double>(a) * d, -static_cast<double>(b) * c, static_cast<double>(b) * d,
+        -static_cast<double>(e) * g, static_cast<double>(e) * h, static_cast<double>(f) * g, -static_cast<double>(f) * h,
+    };
+
+    double expansion[8];
+    auto length = 0;
+    for (const auto term : terms)
+        length = grow_expansion(expansion, length, term);
+
+    const auto largest = expansion[length - 1];
+    return largest > 0 ? 1 : largest < 0 ? -1 : 0;
+}
+
+// calculate the sign of (a - b) * (c - d) - (e - f) * (g - h)
+// the error bound is the one of orient2d by Shewchuk, the inputs are floats
+// so the 4 differences round at most once each like differences of doubles
+int calc_filtered_sign(const float a, const float b, const float c, const float d, const float e, const float f, const float g, const float h)
+{
+    static constexpr double epsilon = numeric_limits<double>::epsilon() / 2;
+    static constexpr double error_bound = (3 + 16 * epsilon) * epsilon;
+
+    const auto left = (static_cast<double>(a) - b) * (static_cast<double>(c) - d);
+    const auto right = (static_cast<double>(e) - f) * (static_cast<double>(g) - h);
+    const auto determinant = left - right;
+    const auto bound = error_bound * (abs(left) + abs(right));
+    if (determinant > bound)
+        return 1;
+    if (-determinant > bound)
+        return -1;
+    return calc_exact_sign(a, b, c, d, e, f, g, h);
+}
+
+// calculate the intersection of 2 line segments given a sign function
+// the segments cross when the lines are not parallel and the ends of each
+// segment are not both on the same side of the other segment
+template <typename Sign>
+static bool calc_intersection_signed(const line_segment& ls1, const line_segment& ls2, point& pt, Sign sign)
+{
+    pt = { 0,0 };
+
+    const auto& A = ls1.p1;
+    const auto& B = ls1.p2;
+    const auto& C = ls2.p1;
+    const auto& D = ls2.p2;
+
+    // the side of r relative to the line p to q
+    auto side = [&sign](const point& p, const point& q, const point& r)
+    {
+        return sign(q.x, p.x, r.y, p.y, q.y, p.y, r.x, p.x);
+    };
+
+    if (sign(B.x, A.x, D.y, C.y, B.y, A.y, D.x, C.x) == 0)
+        return false;
+    if (side(A, B, C) * side(A, B, D) > 0 || side(C, D, A) * side(C, D, B) > 0)
+        return false;
+
+    const auto x1_x2 = static_cast<double>(A.x) - B.x;
+    const auto x1_x3 = static_cast<double>(A.x) - C.x;
+    const auto x3_x4 = static_cast<double>(C.x) - D.x;
+    const auto y1_y2 = static_cast<double>(A.y) - B.y;
+    const auto y1_y3 = static_cast<double>(A.y) - C.y;
+    const auto y3_y4 = static_cast<double>(C.y) - D.y;
+    const auto denominator = x1_x2 * y3_y4 - y1_y2 * x3_x4;
+    const auto t = min(1.0, max(0.0, (x1_x3 * y3_y4 - y1_y3 * x3_x4) / denominator));
+
+    pt = point(static_cast<float>(A.x - t * x1_x2), static_cast<float>(A.y - t * y1_y2));
+    return true;
+}
+
+// calculate the intersection of 2 line segments with exact crossing tests
+bool calc_intersection_exact(const line_segment& ls1, const line_segment& ls2, point& pt)
+{
+    return calc_intersection_signed(ls1, ls2, pt, calc_exact_sign);
+}
+
+// calculate the intersection of 2 line segments with filtered crossing tests
+bool calc_intersection_filtered(const line_segment& ls1, const line_segment& ls2, point& pt)
+{
+    return calc_intersection_signed(ls1, ls2, pt, calc_filtered_sign);
+}
+
+// the pool the asynchronous calculations run on
+// created with one thread per core the first time it is used
+task_pool& shared_pool()
+{
+    static task_pool pool;
+    return pool;
+}
+
+// calculate the triangles of line segments for an asynchronous caller
+// the cancel flag is checked between chunks of first segments
+void calc_triangles(const segment_view& segments, const async_options& options, triangle_result& result)
+{
+    const auto start = chrono::steady_clock::now();
+    crossing_graph graph;
+    prepare_crossing_graph(segments, graph, intersection_kernel::branching, options.cancel.get());
+    const auto prepared = chrono::steady_clock::now();
+
+    result.stats.segments = segments.size();
+    result.stats.kept_segments = graph.adjacency.size();
+    for (const auto& edges : graph.adjacency)
+        result.stats.crossings += edges.size();
+    result.stats.crossings /= 2;
+
+    const int num_line_segments = static_cast<int>(graph.adjacency.size());
+    for (auto first = 0; first < num_line_segments && !result.truncated; first += enumeration_chunk)
     {
-        cout <<
-            "(" << setw(3) << triangle.p1.x << ", " << setw(3) << triangle.p1.y << "), " <<
-            "(" << setw(3) << triangle.p2.x << ", " << setw(3) << triangle.p2.y << "), " <<
-            "(" << setw(3) << triangle.p3.x << ", " << setw(3) << triangle.p3.y << ")" <<
-            endl;
+        if (options.cancel->load(memory_order_relaxed))
+        {
+            result.cancelled = true;
+            break;
+        }
+
+        visit_triangles(graph, first, min(first + enumeration_chunk, num_line_segments), options.filter,
+            [&](int, int, int, const point& p1, const point& p2, const point& p3)
+            {
+                if (result.triangles.size() < options.max_triangles)
+                    result.triangles.emplace_back(p1, p2, p3);
+                else
+                    result.truncated = true;
+            });
     }
-    cout << endl << "There are " << triangles.size() << " triangle(s) found." << endl;
+
+    result.partial = result.cancelled || result.truncated;
+    result.stats.triangles = result.triangles.size();
+    result.stats.prepare_ms = chrono::duration<double, milli>(prepared - start).count();
+    result.stats.enumerate_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - prepared).count();
+}
+
+// calculate the triangles of line segments on the shared pool
+// the segments are moved into the task so the caller does not have to keep them
+// done is called on a pool thread with the result
+// a calculation that throws, for example out of memory, gives done
+// a result with only the error set
+// an event loop would post the result back to its own thread from done
+void calc_triangles_async(vector<line_segment> segments, const async_options& options, function<void(triangle_result)> done)
+{
+    auto input = make_shared<vector<line_segment>>(move(segments));
+    shared_pool().submit([input, options, done]
+    {
+        triangle_result result;
+        try
+        {
+            calc_triangles(*input, options, result);
+        }
+        catch (...)
+        {
+            result = triangle_result();
+            result.error = current_exception();
+        }
+        done(move(result));
+    });
+}
+
+// calculate the triangles of line segments on the shared pool
+// returns a future that is ready with the result
+// or holds the exception of a failed calculation
+future<triangle_result> calc_triangles_async(vector<line_segment> segments, const async_options& options)
+{
+    auto promised = make_shared<promise<triangle_result>>();
+    auto result = promised->get_future();
+    calc_triangles_async(move(segments), options, [promised](triangle_result done)
+    {
+        if (done.error)
+            promised->set_exception(done.error);
+        else
+            promised->set_value(move(done));
+    });
+    return result;
+}
+
+#if defined(FIND_TRIANGLES_COROUTINES)
+
+// calculate the triangles of line segments with co_await
+triangle_awaitable calc_triangles_awaitable(vector<line_segment> segments, const async_options& options)
+{
+    return triangle_awaitable{ move(segments), options, triangle_result() };
+}
+#endif
+
+// Define the state behind the C interface
+// triangles holds the result of the last ft_find_triangles
+struct ft_context
+{
+    vector<triangle> triangles;
+};
+
+// check line segments in caller memory for the C interface
+// each segment is 4 floats starting stride bytes after the one before
+// segments closer together than 4 floats would overlap
+static bool valid_segments(const float* segments, const size_t stride, const size_t count)
+{
+    return count == 0 || (segments != nullptr && (count == 1 || stride >= 4 * sizeof(float)));
+}
+
+// run a call of the C interface
+// exceptions must not cross into C so they are turned into a status
+template <typename Call>
+static ft_status run_c_call(Call call)
+{
+    try
+    {
+        return call();
+    }
+    catch (const bad_alloc&)
+    {
+        return FT_OUT_OF_MEMORY;
+    }
+    catch (...)
+    {
+        return FT_INTERNAL_ERROR;
+    }
+}
+
+ft_context* ft_create(void)
+{
+    return new (nothrow) ft_context();
+}
+
+void ft_destroy(ft_context* context)
+{
+    delete context;
+}
+
+ft_status ft_find_triangles(ft_context* context, const float* segments, const size_t stride, const size_t count, size_t* triangle_count)
+{
+    if (context == nullptr || triangle_count == nullptr)
+        return FT_INVALID_ARGUMENT;
+
+    return run_c_call([&]
+    {
+        if (!valid_segments(segments, stride, count))
+            return FT_INVALID_ARGUMENT;
+
+        context->triangles.clear();
+        calc_triangles(segment_view(segments, stride, count), context->triangles);
+        *triangle_count = context->triangles.size();
+        return FT_OK;
+    });
+}
+
+ft_status ft_copy_triangles(const ft_context* context, ft_triangle* triangles, const size_t capacity, size_t* written)
+{
+    if (context == nullptr || written == nullptr)
+        return FT_INVALID_ARGUMENT;
+
+    *written = 0;
+    if (capacity < context->triangles.size())
+        return FT_BUFFER_TOO_SMALL;
+    if (triangles == nullptr && !context->triangles.empty())
+        return FT_INVALID_ARGUMENT;
+
+    for (const auto& triangle : context->triangles)
+        triangles[(*written)++] = { triangle.p1.x, triangle.p1.y, triangle.p2.x, triangle.p2.y, triangle.p3.x, triangle.p3.y };
+    return FT_OK;
+}
+
+ft_status ft_count_segment_triangles(ft_context* context, const float* segments, const size_t stride, const size_t count, long long* counts)
+{
+    if (context == nullptr || (counts == nullptr && count > 0))
+        return FT_INVALID_ARGUMENT;
+
+    return run_c_call([&]
+    {
+        if (!valid_segments(segments, stride, count))
+            return FT_INVALID_ARGUMENT;
+
+        vector<long long> result;
+        calc_segment_triangle_counts(segment_view(segments, stride, count), result);
+        copy(result.begin(), result.end(), counts);
+        return FT_OK;
+    });
 }
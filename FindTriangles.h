@@ -0,0 +1,2227 @@
+// ReSharper disable CppInconsistentNaming
+#ifndef FIND_TRIANGLES_H
+#define FIND_TRIANGLES_H
+
+// Triangle finder library
+// finds the triangles formed by a set of line segments
+//
+// the batch engines take a segment_view and write to a vector, a queue
+// or a visitor, the scene and stream workspaces keep their state between
+// calls, and the queues can be used as sinks by other threads
+// FindTrianglesC.h declares the same engines for callers written in C
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <limits>
+#include <random>
+#include <vector>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+
+// C++20 builds can co_await the asynchronous calculations
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#define FIND_TRIANGLES_COROUTINES
+#endif
+
+// Margin of error for comparing floats
+static constexpr double compare_tolerance = .00001;
+
+// Define a point structure
+// with floats for x and y
+// override the == operator to compare to another point
+typedef struct point
+{
+    float x;
+    float y;
+
+    point(const float x, const float y)
+        : x(x),
+        y(y)
+    {}
+
+    bool operator==(const point& other) const
+    {
+        return std::abs(x - other.x) < compare_tolerance && std::abs(y - other.y) < compare_tolerance;
+    }
+} point;
+
+// Define a line segment structure as 2 points
+typedef struct line_segment
+{
+    point p1;
+    point p2;
+
+    line_segment(const float a, const float b, const float c, const float d)
+        : p1(a, b),
+        p2(c, d)
+    {}
+
+    line_segment(const point& p1, const point& p2)
+        : p1(p1),
+        p2(p2)
+    {}
+} line_segment;
+
+// Define a read only view of line segments in caller memory
+// each segment is 4 floats x1, y1, x2, y2 one after another
+// stride is the number of bytes from one segment to the next
+// so the segments can be interleaved with other data
+// a vector of line segments converts to a view without copying
+typedef struct segment_view
+{
+    const unsigned char* base;
+    size_t stride;
+    size_t count;
+
+    segment_view(const float* segments, const size_t stride, const size_t count)
+        : base(reinterpret_cast<const unsigned char*>(segments)),
+        stride(stride),
+        count(count)
+    {}
+
+    segment_view(const std::vector<line_segment>& segments)
+        : base(reinterpret_cast<const unsigned char*>(segments.data())),
+        stride(sizeof(line_segment)),
+        count(segments.size())
+    {}
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    // the floats are copied out so they do not need to be aligned
+    line_segment operator[](const size_t index) const
+    {
+        float coords[4];
+        std::memcpy(coords, base + index * stride, sizeof(coords));
+        return line_segment(coords[0], coords[1], coords[2], coords[3]);
+    }
+
+    typedef struct iterator
+    {
+        const segment_view* view;
+        size_t index;
+
+        line_segment operator*() const
+        {
+            return (*view)[index];
+        }
+
+        iterator& operator++()
+        {
+            ++index;
+            return *this;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return index != other.index;
+        }
+    } iterator;
+
+    iterator begin() const
+    {
+        return { this, 0 };
+    }
+
+    iterator end() const
+    {
+        return { this, count };
+    }
+} segment_view;
+
+// define a triangle structure as 3 points
+typedef struct triangle
+{
+    point p1;
+    point p2;
+    point p3;
+
+    triangle()
+        : p1(0, 0),
+        p2(0, 0),
+        p3(0, 0)
+    {}
+
+    triangle(const point& p1, const point& p2, const point& p3)
+        : p1(p1),
+        p2(p2),
+        p3(p3)
+    {}
+} triangle;
+
+// Define an axis aligned rectangle
+// with the lowest and highest x and y
+typedef struct rect
+{
+    float min_x;
+    float min_y;
+    float max_x;
+    float max_y;
+
+    rect(const float min_x, const float min_y, const float max_x, const float max_y)
+        : min_x(min_x),
+        min_y(min_y),
+        max_x(max_x),
+        max_y(max_y)
+    {}
+
+    // a point on the edge is contained
+    bool contains(const point& pt) const
+    {
+        return pt.x >= min_x && pt.x <= max_x && pt.y >= min_y && pt.y <= max_y;
+    }
+
+    bool overlaps(const rect& other) const
+    {
+        return min_x <= other.max_x && other.min_x <= max_x && min_y <= other.max_y && other.min_y <= max_y;
+    }
+} rect;
+
+// Define constraints on the triangles to find
+// a triangle is only output when it meets all of them
+// angles are in radians
+// bounds is only used when bounded is true
+typedef struct triangle_filter
+{
+    double min_area = 0;
+    double max_area = std::numeric_limits<double>::infinity();
+    double max_perimeter = std::numeric_limits<double>::infinity();
+    double min_angle = 0;
+    bool bounded = false;
+    rect bounds = rect(0, 0, 0, 0);
+} triangle_filter;
+
+// calculate the distance between 2 points
+double calc_distance(const point& a, const point& b);
+
+// calculate twice the signed area of the triangle a, b, c
+// positive when the points turn counter clockwise
+double calc_cross(const point& a, const point& b, const point& c);
+
+// determine if a triangle with a given first point can meet a filter
+bool can_meet(const triangle_filter& filter, const point& a);
+
+// determine if a triangle with 2 given points can meet a filter
+// the perimeter is at least twice the side a b
+// inside the bounds the third point is at most as far from the
+// line through a and b as the farthest corner, which limits the area
+bool can_meet(const triangle_filter& filter, const point& a, const point& b);
+
+// determine if a triangle meets a filter
+bool meets(const triangle_filter& filter, const point& a, const point& b, const point& c);
+
+// Define a crossing as the index of the line segment crossed
+// and the point where the 2 line segments intersect
+// vertex is the id of the cluster the point belongs to once clustered
+typedef struct crossing
+{
+    int segment;
+    point pt;
+    int vertex;
+
+    crossing()
+        : segment(-1),
+        pt(0, 0),
+        vertex(-1)
+    {}
+
+    crossing(const int segment, const point& pt)
+        : segment(segment),
+        pt(pt),
+        vertex(-1)
+    {}
+} crossing;
+
+// Define a crossing graph with a vertex for each line segment
+// adjacency[N] contains the crossings of line segment N sorted by segment
+// labels[N] contains the original index of line segment N
+// crossings at the same point share a vertex id, see cluster_crossing_points
+typedef struct crossing_graph
+{
+    std::vector<std::vector<crossing>> adjacency;
+    std::vector<int> labels;
+} crossing_graph;
+
+// Define clusters of points as a union find forest
+// parent[N] leads towards the root of the cluster of point N
+// size[N] is the number of points in the cluster when N is a root
+typedef struct point_clusters
+{
+    std::vector<int> parent;
+    std::vector<int> size;
+
+    explicit point_clusters(const int count)
+        : parent(count),
+        size(count, 1)
+    {
+        for (auto i = 0; i < count; ++i)
+            parent[i] = i;
+    }
+
+    // the path is halved on the way so later finds are shorter
+    int find(int index)
+    {
+        while (parent[index] != index)
+        {
+            parent[index] = parent[parent[index]];
+            index = parent[index];
+        }
+        return index;
+    }
+
+    // add a point in a cluster of its own
+    // returns the index of the new point
+    int add()
+    {
+        const auto index = static_cast<int>(parent.size());
+        parent.push_back(index);
+        size.push_back(1);
+        return index;
+    }
+
+    // the smaller cluster goes under the larger one
+    void merge(const int a, const int b)
+    {
+        auto root_a = find(a);
+        auto root_b = find(b);
+        if (root_a == root_b)
+            return;
+
+        if (size[root_a] < size[root_b])
+            std::swap(root_a, root_b);
+        parent[root_b] = root_a;
+        size[root_a] += size[root_b];
+    }
+} point_clusters;
+
+// cluster the crossing points of a crossing graph into vertices
+// points equal within compare_tolerance are merged, and so are points
+// joined through a chain of equal points, so one physical vertex gets
+// one id even where point::operator== is not transitive
+// every crossing is given the id of its vertex
+// the adjacency lists must be sorted
+// returns the number of vertices
+int cluster_crossing_points(crossing_graph& graph);
+
+// determine if a given point is contained in a vector of points
+bool find_point(std::vector<point>& points, const point& pt);
+
+// Define a list of points stored as separate x and y arrays
+// so find_point can compare several points with one instruction
+typedef struct point_list
+{
+    std::vector<float> x;
+    std::vector<float> y;
+
+    point_list() = default;
+
+    explicit point_list(const std::vector<point>& points)
+    {
+        x.reserve(points.size());
+        y.reserve(points.size());
+        for (const auto& pt : points)
+            push_back(pt);
+    }
+
+    int size() const
+    {
+        return static_cast<int>(x.size());
+    }
+
+    point operator[](const int index) const
+    {
+        return point(x[index], y[index]);
+    }
+
+    void push_back(const point& pt)
+    {
+        x.push_back(pt.x);
+        y.push_back(pt.y);
+    }
+} point_list;
+
+// the tolerance of point::operator== as a float
+// abs(a - b) <= point_tolerance gives the same answer as
+// abs(a - b) < compare_tolerance after the promotion to double
+float calc_point_tolerance();
+
+// determine if a given point is contained in a list of points
+// the x and y distance of 8 points is checked against the tolerance at a time
+bool find_point(const point_list& points, const point& pt);
+
+// copy vectors of points into point lists
+void to_point_lists(const std::vector<std::vector<point>>& intersects, std::vector<point_list>& lists);
+
+// calculate the intersection of 2 line segments
+// segment 1 = points A and B
+// segment 2 = points C and D
+// if there is an intersection return the point in pt
+// from https://en.wikipedia.org/wiki/Line%E2%80%93line_intersection
+bool calc_intersection(const point& A, const point& B, const point& C, const point& D, point& pt);
+
+// calculate the intersection of 2 line segments
+// given 2 line segments
+// if there is an intersection return the point in pt
+bool calc_intersection(const line_segment& ls1, const line_segment& ls2, point& pt);
+
+// calculate the intersection of 2 line segments without branches
+// the same terms as calc_intersection but the denominator, t and u tests
+// are combined into a hit mask instead of returning early
+// the point is always calculated and is only valid when true is returned
+// use when the hits are close to random and the branches mispredict
+bool calc_intersection_branchless(const line_segment& ls1, const line_segment& ls2, point& pt);
+
+// number of line segments in a tile of the pair loop
+// a tile of rows and a tile of columns fit in the L1 cache together
+static constexpr int intersection_tile = 256;
+
+// size of the register block of the pair loop
+static constexpr int kernel_rows = 4;
+static constexpr int kernel_cols = 8;
+
+// select how the pair loop tests each pair of line segments
+// branching returns early and is fastest when most pairs miss
+// branchless suits dense scenes where hits and misses are close to random
+enum class intersection_kernel
+{
+    branching,
+    branchless
+};
+
+// visit the intersections of a block of pairs of line segments
+// rows start at row and end before row_end
+// columns start at col and end before col_end
+// only pairs with row < col are visited
+// test(i, j, pt) tests the pair i, j and outputs the intersection in pt
+// the hits of the whole block are found first and then passed to
+// hit(i, j, pt) so the calculation stays in registers
+// pairs outside the block are clamped inside it and masked off
+// so the test is called for every pair of the block
+template <typename Test, typename Hit>
+void visit_intersection_block(const int row, const int row_end, const int col, const int col_end, Test& test, Hit& hit)
+{
+    float hit_x[kernel_rows][kernel_cols];
+    float hit_y[kernel_rows][kernel_cols];
+    bool hits[kernel_rows][kernel_cols];
+
+    for (auto r = 0; r < kernel_rows; ++r)
+    {
+        const auto i = row + r;
+        const auto row_index = std::min(i, row_end - 1);
+        for (auto c = 0; c < kernel_cols; ++c)
+        {
+            const auto j = col + c;
+            const auto col_index = std::min(j, col_end - 1);
+            point intersect_pt(0, 0);
+            const bool in_block = (i < row_end) & (j < col_end) & (i < j);
+            hits[r][c] = test(row_index, col_index, intersect_pt) & in_block;
+            hit_x[r][c] = intersect_pt.x;
+            hit_y[r][c] = intersect_pt.y;
+        }
+    }
+
+    for (auto r = 0; r < kernel_rows; ++r)
+    {
+        for (auto c = 0; c < kernel_cols; ++c)
+        {
+            if (hits[r][c])
+                hit(row + r, col + c, point(hit_x[r][c], hit_y[r][c]));
+        }
+    }
+}
+
+// visit the intersections of every pair of line segments
+// the pairs are visited in tiles of rows and columns so both tiles
+// stay in cache while every pair between them is tested
+// and each tile is tested in register blocks by visit_intersection_block
+// hit(i, j, pt) is called with i < j for every pair that intersects
+// the hits of a segment do not come in order of the other segment
+// stop() is called before each tile and ends the loop when it returns true
+template <typename Test, typename Hit, typename Stop>
+void visit_intersections(const int num_line_segments, Test test, Hit hit, Stop stop)
+{
+    for (auto row_tile = 0; row_tile < num_line_segments; row_tile += intersection_tile)
+    {
+        const auto row_tile_end = std::min(row_tile + intersection_tile, num_line_segments);
+        for (auto col_tile = row_tile; col_tile < num_line_segments; col_tile += intersection_tile)
+        {
+            if (stop())
+                return;
+
+            const auto col_tile_end = std::min(col_tile + intersection_tile, num_line_segments);
+            for (auto row = row_tile; row < row_tile_end; row += kernel_rows)
+            {
+                for (auto col = std::max(col_tile, row + 1); col < col_tile_end; col += kernel_cols)
+                    visit_intersection_block(row, row_tile_end, col, col_tile_end, test, hit);
+            }
+        }
+    }
+}
+
+// visit the intersections of every pair of line segments without stopping
+template <typename Test, typename Hit>
+void visit_intersections(const int num_line_segments, Test test, Hit hit)
+{
+    visit_intersections(num_line_segments, test, hit, [] { return false; });
+}
+
+// call visit with the intersection function selected by kernel
+// so a pair loop is compiled once for each kernel
+template <typename Visit>
+void select_intersection_kernel(const intersection_kernel kernel, Visit visit)
+{
+    if (kernel == intersection_kernel::branchless)
+    {
+        visit([](const line_segment& ls1, const line_segment& ls2, point& pt)
+            { return calc_intersection_branchless(ls1, ls2, pt); });
+    }
+    else
+    {
+        visit([](const line_segment& ls1, const line_segment& ls2, point& pt)
+            { return calc_intersection(ls1, ls2, pt); });
+    }
+}
+
+// add an intersection to the lists of both its line segments
+// unless the lists already hold the point
+void add_intersection(std::vector<point_list>& intersects, const int i, const int j, const point& pt);
+
+// calculate the intersections of a block of line segments
+// rows start at row and end before row_end
+// columns start at col and end before col_end
+// only pairs with row < col are calculated
+template <typename Kernel>
+void calc_intersection_block(const segment_view& segments, const int row, const int row_end, const int col, const int col_end, Kernel kernel, std::vector<point_list>& intersects)
+{
+    auto test = [&](const int i, const int j, point& pt) { return kernel(segments[i], segments[j], pt); };
+    auto hit = [&intersects](const int i, const int j, const point& pt) { add_intersection(intersects, i, j, pt); };
+    visit_intersection_block(row, row_end, col, col_end, test, hit);
+}
+
+// calculate the intersections of line segments
+// given a vector of line segments
+// output the intersections in a vector of point vectors
+// vector[0] will output a vector of all the intersections in line segment 0
+// vector[1] will output a vector of all the intersections in line segment 1
+// vector[N] will output a vector of all the intersections in line segment N
+// the pairs are visited in tiles by visit_intersections
+// kernel selects the branching or branchless intersection test
+template <typename Kernel>
+void calc_intersections(const segment_view& segments, Kernel kernel, std::vector<point_list>& intersects)
+{
+    visit_intersections(static_cast<int>(segments.size()),
+        [&](const int i, const int j, point& pt) { return kernel(segments[i], segments[j], pt); },
+        [&intersects](const int i, const int j, const point& pt) { add_intersection(intersects, i, j, pt); });
+}
+
+// calculate the intersections of line segments
+// given a vector of line segments
+// output the intersections in a vector of point lists
+// lists[N] will output a list of all the intersections in line segment N
+// kernel selects the branching or branchless intersection test
+void calc_intersections(const segment_view& segments, std::vector<point_list>& intersects, const intersection_kernel kernel = intersection_kernel::branching);
+
+// calculate the intersections of line segments
+// given a vector of line segments
+// output the intersections in a vector of point vectors
+// vector[N] will output a vector of all the intersections in line segment N
+// kernel selects the branching or branchless intersection test
+void calc_intersections(const segment_view& segments, std::vector<std::vector<point>>& intersects, const intersection_kernel kernel = intersection_kernel::branching);
+
+// spread the lower 16 bits of a value so there is
+// a 0 bit between each of them
+// used to interleave x and y into a morton key
+uint32_t spread_bits(uint32_t value);
+
+// calculate the spatial order of line segments
+// the midpoint of each segment is quantized to 16 bits per axis
+// inside the bounds of all midpoints and interleaved into a morton key
+// order[0] will output the index of the first segment along the curve
+// order[N] will output the index of the Nth segment along the curve
+// segments that are close together end up close together in the order
+// segments with a non finite midpoint are put at the end
+void calc_spatial_order(const segment_view& segments, std::vector<int>& order);
+
+// reorder line segments
+// given a vector of line segments and the order from calc_spatial_order
+// reordered[N] will output segments[order[N]]
+void reorder_segments(const segment_view& segments, const std::vector<int>& order, std::vector<line_segment>& reordered);
+
+// calculate the intersections of line segments in spatial order
+// the segments are reordered along the morton curve before calculating
+// so segments likely to cross are close together in memory
+// the intersections are mapped back so intersects[N] still belongs to segments[N]
+void calc_intersections_spatial(const segment_view& segments, std::vector<std::vector<point>>& intersects);
+
+// Define what was removed from the input by filter_degenerate_segments
+// kept[N] is the original index of the Nth filtered line segment
+// the other vectors hold the original indices of the removed segments
+// duplicate_of[N] is the original index of the segment duplicates[N] repeats
+typedef struct filter_report
+{
+    std::vector<int> kept;
+    std::vector<int> non_finite;
+    std::vector<int> zero_length;
+    std::vector<int> duplicates;
+    std::vector<int> duplicate_of;
+} filter_report;
+
+// the 4 coordinates of a line segment are loaded as one vector
+static_assert(sizeof(line_segment) == 4 * sizeof(float), "line_segment must be 4 packed floats");
+
+// determine if all 4 coordinates of a line segment are finite
+// and if its 2 end points are the same point
+// both tests are done on all coordinates at once
+void check_segment(const line_segment& segment, bool& finite, bool& zero_length);
+
+// Define the exact bits of a line segment with its end points in a fixed order
+// so a segment and the same segment reversed hash the same
+typedef struct segment_key
+{
+    uint32_t bits[4];
+
+    explicit segment_key(const line_segment& segment)
+    {
+        // adding 0 turns -0 into 0 so both compare the same
+        const auto forward = segment.p1.x < segment.p2.x || (segment.p1.x == segment.p2.x && segment.p1.y <= segment.p2.y);
+        const float coords[4] =
+        {
+            (forward ? segment.p1.x : segment.p2.x) + 0.0f,
+            (forward ? segment.p1.y : segment.p2.y) + 0.0f,
+            (forward ? segment.p2.x : segment.p1.x) + 0.0f,
+            (forward ? segment.p2.y : segment.p1.y) + 0.0f,
+        };
+        std::memcpy(bits, coords, sizeof(bits));
+    }
+
+    bool operator==(const segment_key& other) const
+    {
+        return std::memcmp(bits, other.bits, sizeof(bits)) == 0;
+    }
+} segment_key;
+
+// hash the bits of a segment key
+typedef struct segment_key_hash
+{
+    size_t operator()(const segment_key& key) const
+    {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (const auto bits : key.bits)
+            hash = (hash ^ bits) * 0x100000001b3ull;
+        return static_cast<size_t>(hash);
+    }
+} segment_key_hash;
+
+// filter degenerate line segments from the input
+// given a vector of line segments
+// output the usable segments in filtered
+// segments with a NaN or Inf coordinate, zero length segments
+// and exact duplicates of an earlier segment are removed
+// report will output the original index of every kept and removed segment
+void filter_degenerate_segments(const segment_view& segments, std::vector<line_segment>& filtered, filter_report& report);
+
+// Define the supporting line of a line segment
+// angle is the direction of the line in the range -pi/2 to pi/2
+// offset is the signed distance of the line from the origin
+// start and end are the ends of the segment measured along the line
+// flipped is true when p2 is at the start of the segment
+typedef struct supporting_line
+{
+    double angle;
+    double offset;
+    double start;
+    double end;
+    bool flipped;
+} supporting_line;
+
+// calculate the supporting line of a line segment
+// the direction is flipped so both ends of the segment give the same line
+supporting_line calc_supporting_line(const line_segment& segment);
+
+// turn a supporting line around so its angle is a half turn higher
+// the same line seen from the other direction
+void flip_supporting_line(supporting_line& line);
+
+// calculate the distance of a point from a supporting line
+// measured perpendicular to the line
+double calc_line_distance(const supporting_line& line, const point& pt);
+
+// merge collinear line segments that overlap, touch or are duplicates
+// given a vector of line segments
+// output the merged segments in merged
+// mapping[N] will output the index in merged of segments[N]
+// the segments are grouped by the angle and offset of their supporting line
+// to find candidates, then each group is swept along the line and a segment
+// joins a piece only when both its ends are within the tolerance of the line
+// of the first segment of the piece
+// merged keeps the order of the first segment of each merged piece
+// and a segment that is not merged is output unchanged
+// zero length segments have no supporting line and are kept as they are
+void merge_collinear_segments(const std::vector<line_segment>& segments, std::vector<line_segment>& merged, std::vector<int>& mapping);
+
+// calculate the crossing graph of line segments
+// the segments are visited in spatial order so crossing segments
+// get labels that are close together
+// graph.labels maps each vertex back to the index in segments
+// the pairs are tested in tiled register blocks with the selected kernel
+// when cancel is set the pair loop stops at the next tile
+// and the graph only holds the crossings found until then
+void calc_crossing_graph(const segment_view& segments, crossing_graph& graph, const intersection_kernel kernel = intersection_kernel::branching,
+    const std::atomic<bool>* cancel = nullptr);
+
+// relabel the vertices of a crossing graph with reverse Cuthill-McKee
+// each connected component is walked breadth first starting at its
+// lowest degree vertex, visiting neighbors in order of increasing degree
+// the reversed walk keeps the adjacency lists of crossing segments
+// close together in memory during triangle enumeration
+void reorder_crossing_graph(crossing_graph& graph);
+
+// visit a triangle in the original order of its segments
+// given the vertices one, two and three of a graph labelled by vertex_labels
+// and the points point_12, point_23 and point_31 where they cross
+template <typename Visit>
+void visit_in_order(const int* vertex_labels, const int one, const int two, const int three,
+    const point& point_12, const point& point_23, const point& point_31, Visit& visit)
+{
+    // the point between 2 segments is indexed by the third segment
+    const int labels[3] = { vertex_labels[one], vertex_labels[two], vertex_labels[three] };
+    const point* opposite[3] = { &point_23, &point_31, &point_12 };
+    int order[3] = { 0, 1, 2 };
+    std::sort(order, order + 3, [&labels](const int a, const int b) { return labels[a] < labels[b]; });
+    visit(labels[order[0]], labels[order[1]], labels[order[2]],
+        *opposite[order[2]], *opposite[order[0]], *opposite[order[1]]);
+}
+
+// visit a triangle of a crossing graph in the original order of its segments
+template <typename Visit>
+void visit_in_order(const crossing_graph& graph, const int one, const int two, const int three,
+    const point& point_12, const point& point_23, const point& point_31, Visit& visit)
+{
+    visit_in_order(graph.labels.data(), one, two, three, point_12, point_23, point_31, visit);
+}
+
+// visit the triangles of a crossing graph
+// every 3 line segments that cross each other at 3 different points form a triangle
+// the adjacency lists are sorted so the third segment is found by merging
+// the lists of the first two segments
+// only the first segments from first up to last are visited
+// so the graph can be split between threads
+// visit is called with the original indices of the 3 segments in order
+// and the points in the same order as calc_triangles given the intersections
+// a first crossing outside the filter bounds skips the merge for that pair
+// the crossings must have vertex ids from cluster_crossing_points, which
+// calc_crossing_graph and prepare_crossing_graph assign
+template <typename Visit>
+void visit_triangles(const crossing_graph& graph, const int first, const int last, const triangle_filter& filter, Visit visit)
+{
+    auto after = [](const std::vector<crossing>& edges, const int segment)
+    {
+        return std::upper_bound(edges.begin(), edges.end(), segment,
+            [](const int value, const crossing& edge) { return value < edge.segment; });
+    };
+
+    for (auto segment_one_index = first; segment_one_index < last; ++segment_one_index)
+    {
+        const auto& edges_one = graph.adjacency[segment_one_index];
+        for (auto edge_two = after(edges_one, segment_one_index); edge_two != edges_one.end(); ++edge_two)
+        {
+            if (!can_meet(filter, edge_two->pt))
+                continue;
+
+            const auto segment_two_index = edge_two->segment;
+            const auto& edges_two = graph.adjacency[segment_two_index];
+
+            auto edge_one = edge_two + 1;
+            auto edge_three = after(edges_two, segment_two_index);
+            while (edge_one != edges_one.end() && edge_three != edges_two.end())
+            {
+                if (edge_one->segment < edge_three->segment)
+                {
+                    ++edge_one;
+                    continue;
+                }
+                if (edge_three->segment < edge_one->segment)
+                {
+                    ++edge_three;
+                    continue;
+                }
+
+                // point_ab is where segments a and b cross
+                // 3 segments through one vertex do not form a triangle
+                const auto& point_12 = edge_two->pt;
+                const auto& point_23 = edge_three->pt;
+                const auto& point_31 = edge_one->pt;
+                assert(edge_one->vertex >= 0 && edge_two->vertex >= 0 && edge_three->vertex >= 0);
+                if (!(edge_two->vertex == edge_three->vertex || edge_three->vertex == edge_one->vertex || edge_one->vertex == edge_two->vertex) &&
+                    meets(filter, point_12, point_23, point_31))
+                {
+                    visit_in_order(graph, segment_one_index, segment_two_index, edge_one->segment, point_12, point_23, point_31, visit);
+                }
+                ++edge_one;
+                ++edge_three;
+            }
+        }
+    }
+}
+
+// calculate the triangles of a crossing graph
+// the points are output in the order of the original segment indices
+// the same as calc_triangles given the intersections
+void calc_triangles(const crossing_graph& graph, std::vector<triangle>& triangles, const triangle_filter& filter = triangle_filter());
+
+// calculate the triangles with the intersections of line segments
+// intersects[0] contains the intersection points for line segment 0
+// intersects[1] contains the intersection points for line segment 1
+// intersects[N] contains the intersection points for line segment N
+// the membership tests use point lists so they run on find_point's vector path
+// the filter is checked as soon as the first 2 points are known
+// and the search for a third segment is skipped when it cannot be met
+void calc_triangles(std::vector<std::vector<point>>& intersects, std::vector<triangle>& triangles, const triangle_filter& filter = triangle_filter());
+
+// prepare the crossing graph of line segments for triangle enumeration
+// filter NaN, Inf, zero length and duplicate segments from the input
+// merge collinear segments that overlap so each line is only counted once
+// calculate the crossing graph for the segments
+// relabel the graph so crossing segments are close together
+// graph.labels are indices into the merged segments, not the input
+// mapping[N] will output the merged index of segments[N]
+// a duplicate gets the index of the segment it repeats
+// and the other segments filtered from the input get -1
+// kernel selects the intersection test of the pair loop
+// cancel stops the pair loop early like calc_crossing_graph
+void prepare_crossing_graph(const segment_view& segments, crossing_graph& graph, std::vector<int>& mapping,
+    const intersection_kernel kernel = intersection_kernel::branching, const std::atomic<bool>* cancel = nullptr);
+
+// prepare the crossing graph of line segments for triangle enumeration
+// when the mapping back to the input is not needed
+void prepare_crossing_graph(const segment_view& segments, crossing_graph& graph, const intersection_kernel kernel = intersection_kernel::branching,
+    const std::atomic<bool>* cancel = nullptr);
+
+// calculate the triangles with the intersections of line segments
+// prepare the crossing graph for the segments
+// calculate the triangles given the crossing graph
+// only triangles meeting the filter are output
+// kernel selects the intersection test, branchless suits dense scenes
+int calc_triangles(const segment_view& segments, std::vector<triangle>& triangles, const triangle_filter& filter = triangle_filter(),
+    const intersection_kernel kernel = intersection_kernel::branching);
+
+// Define the summaries collected by triangle_stats
+// the area and perimeter histograms have bins of a fixed width
+// and the last bin also counts everything above it
+// the triangles are counted in a grid of cells over bounds by their centroid
+// centroids outside bounds are not counted in any cell
+typedef struct stats_config
+{
+    double area_bin_width = 1;
+    int area_bins = 32;
+    double perimeter_bin_width = 1;
+    int perimeter_bins = 32;
+    rect bounds = rect(0, 0, 0, 0);
+    int columns = 0;
+    int rows = 0;
+} stats_config;
+
+// Define running statistics over triangles
+// each thread adds to its own stats and the results are merged
+typedef struct triangle_stats
+{
+    long long count = 0;
+    double min_area = std::numeric_limits<double>::infinity();
+    double max_area = 0;
+    double sum_area = 0;
+    double min_perimeter = std::numeric_limits<double>::infinity();
+    double max_perimeter = 0;
+    double sum_perimeter = 0;
+    std::vector<long long> area_histogram;
+    std::vector<long long> perimeter_histogram;
+    std::vector<long long> cell_counts;
+
+    triangle_stats() = default;
+
+    explicit triangle_stats(const stats_config& config)
+        : area_histogram(std::max(1, config.area_bins), 0),
+        perimeter_histogram(std::max(1, config.perimeter_bins), 0),
+        cell_counts(static_cast<size_t>(config.columns) * config.rows, 0)
+    {}
+
+    double mean_area() const
+    {
+        return count == 0 ? 0 : sum_area / static_cast<double>(count);
+    }
+
+    double mean_perimeter() const
+    {
+        return count == 0 ? 0 : sum_perimeter / static_cast<double>(count);
+    }
+
+    void add(const stats_config& config, const point& a, const point& b, const point& c)
+    {
+        const auto area = std::abs(calc_cross(a, b, c)) / 2;
+        const auto perimeter = calc_distance(a, b) + calc_distance(b, c) + calc_distance(c, a);
+
+        ++count;
+        min_area = std::min(min_area, area);
+        max_area = std::max(max_area, area);
+        sum_area += area;
+        min_perimeter = std::min(min_perimeter, perimeter);
+        max_perimeter = std::max(max_perimeter, perimeter);
+        sum_perimeter += perimeter;
+
+        auto bin = [](const double value, const double width, const size_t bins)
+        {
+            const auto index = width > 0 ? value / width : 0.0;
+            return index < static_cast<double>(bins - 1) ? static_cast<size_t>(index) : bins - 1;
+        };
+        ++area_histogram[bin(area, config.area_bin_width, area_histogram.size())];
+        ++perimeter_histogram[bin(perimeter, config.perimeter_bin_width, perimeter_histogram.size())];
+
+        if (!cell_counts.empty())
+        {
+            const auto x = (static_cast<double>(a.x) + b.x + c.x) / 3;
+            const auto y = (static_cast<double>(a.y) + b.y + c.y) / 3;
+            const auto& bounds = config.bounds;
+            if (x >= bounds.min_x && x <= bounds.max_x && y >= bounds.min_y && y <= bounds.max_y)
+            {
+                const auto column = std::min(config.columns - 1, static_cast<int>((x - bounds.min_x) / (static_cast<double>(bounds.max_x) - bounds.min_x) * config.columns));
+                const auto row = std::min(config.rows - 1, static_cast<int>((y - bounds.min_y) / (static_cast<double>(bounds.max_y) - bounds.min_y) * config.rows));
+                ++cell_counts[static_cast<size_t>(row) * config.columns + column];
+            }
+        }
+    }
+
+    // merge stats collected with the same config
+    void merge(const triangle_stats& other)
+    {
+        count += other.count;
+        min_area = std::min(min_area, other.min_area);
+        max_area = std::max(max_area, other.max_area);
+        sum_area += other.sum_area;
+        min_perimeter = std::min(min_perimeter, other.min_perimeter);
+        max_perimeter = std::max(max_perimeter, other.max_perimeter);
+        sum_perimeter += other.sum_perimeter;
+        for (size_t bin = 0; bin < area_histogram.size(); ++bin)
+            area_histogram[bin] += other.area_histogram[bin];
+        for (size_t bin = 0; bin < perimeter_histogram.size(); ++bin)
+            perimeter_histogram[bin] += other.perimeter_histogram[bin];
+        for (size_t cell = 0; cell < cell_counts.size(); ++cell)
+            cell_counts[cell] += other.cell_counts[cell];
+    }
+} triangle_stats;
+
+// number of first segments a thread takes at a time
+static constexpr int enumeration_chunk = 64;
+
+// run work over the first segments of a crossing graph on several threads
+// the first segments are handed out to the threads in chunks
+// work(worker, first, last) is called for each chunk
+// thread_count 0 uses one thread per core
+// returns the number of threads used
+template <typename Work>
+int run_in_chunks(const int num_line_segments, int thread_count, Work work)
+{
+    if (thread_count <= 0)
+        thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    std::atomic<int> next_chunk(0);
+    auto worker_loop = [&](const int worker)
+    {
+        for (auto first = next_chunk.fetch_add(enumeration_chunk); first < num_line_segments; first = next_chunk.fetch_add(enumeration_chunk))
+            work(worker, first, std::min(first + enumeration_chunk, num_line_segments));
+    };
+
+    std::vector<std::thread> threads;
+    for (auto worker = 1; worker < thread_count; ++worker)
+        threads.emplace_back(worker_loop, worker);
+    worker_loop(0);
+    for (auto& worker : threads)
+        worker.join();
+    return thread_count;
+}
+
+// calculate statistics over the triangles of line segments without storing them
+// each thread adds the triangles it finds to its own stats
+// and the stats of all threads are merged at the end
+// thread_count 0 uses one thread per core
+void calc_triangle_stats(const segment_view& segments, const stats_config& config, triangle_stats& stats,
+    int thread_count = 0, const triangle_filter& filter = triangle_filter());
+
+// calculate the number of triangles each line segment is part of
+// without listing the triangles
+// counts[N] will output the number of triangles segments[N] is part of
+// each thread counts into its own vector and the vectors are added at the end
+// duplicates and segments merged into one piece share its count
+// the other segments filtered from the input are part of no triangle
+// thread_count 0 uses one thread per core
+void calc_segment_triangle_counts(const segment_view& segments, std::vector<long long>& counts,
+    int thread_count = 0, const triangle_filter& filter = triangle_filter());
+
+// Define a scene prepared once for repeated queries
+// graph is the prepared crossing graph of the segments
+// mapping[N] is the merged index of segments[N] or -1 when it was filtered
+// vertex[M] is the vertex of merged segment M in the graph
+typedef struct triangle_scene
+{
+    crossing_graph graph;
+    std::vector<int> mapping;
+    std::vector<int> vertex;
+} triangle_scene;
+
+// prepare a scene of line segments for repeated queries
+void prepare_scene(const segment_view& segments, triangle_scene& scene);
+
+// calculate the triangles a single line segment is part of
+// given a prepared scene and the index of the segment in the input
+// only the crossings of the segment and of the segments it crosses are read
+// each crossing segment is merged with the list of the segment
+// to find the third segments crossing both
+// the triangles are output the same as calc_triangles would output them
+// returns the number of triangles found
+int calc_triangles_for_segment(const triangle_scene& scene, const int segment, std::vector<triangle>& triangles,
+    const triangle_filter& filter = triangle_filter());
+
+// Define the limits of the accuracy of estimate_triangle_count
+// so the number of samples stays finite
+static constexpr double min_estimate_error = 0.001;
+static constexpr double max_estimate_error = 0.5;
+static constexpr double min_estimate_confidence = 0.5;
+static constexpr double max_estimate_confidence = 0.999999;
+static constexpr long long max_estimate_samples = 1LL << 24;
+
+// Define the accuracy of estimate_triangle_count
+// error is the largest error of the fraction of closed wedges
+// confidence is the probability the estimate is inside that error
+// values outside the limits are clamped to them and NaN uses the default
+typedef struct estimate_config
+{
+    double error = 0.01;
+    double confidence = 0.95;
+    uint64_t seed = 1;
+} estimate_config;
+
+// Define an estimated number of triangles
+// the number of triangles is between low and high with the given confidence
+// wedges is the number of pairs of crossings that share a segment
+typedef struct triangle_estimate
+{
+    double count = 0;
+    double low = 0;
+    double high = 0;
+    double confidence = 0;
+    double wedges = 0;
+    long long samples = 0;
+} triangle_estimate;
+
+// estimate the number of triangles of a prepared scene by wedge sampling
+// preparing the scene tests every pair of segments, so when the scene
+// is not needed for anything else use the overload below
+// a wedge is a segment with 2 of the segments crossing it
+// a wedge is closed when those 2 segments also cross at a third point
+// every triangle closes exactly 3 wedges so
+// triangles = closed fraction * wedges / 3
+// wedges are picked at random by choosing a segment weighted by its
+// number of wedges and then 2 of its crossings
+// the number of samples comes from the Hoeffding bound
+// samples = ln(2 / (1 - confidence)) / (2 * error^2)
+// so the time depends on the accuracy and not on the number of triangles
+// error and confidence are clamped to their limits first and the
+// samples are capped at max_estimate_samples
+void estimate_triangle_count(const triangle_scene& scene, const estimate_config& config, triangle_estimate& estimate);
+
+// estimate the number of triangles of line segments by wedge sampling
+// the segments are filtered and merged like prepare_crossing_graph but
+// the crossing graph is built from the pairs of grid_pairs, so the time grows
+// with the number of crossings instead of the number of pairs of segments
+// the wedges are sampled the same as the overload above
+void estimate_triangle_count(const segment_view& segments, const estimate_config& config, triangle_estimate& estimate);
+
+// Define the outcome of a calculation into fixed buffers
+// an overflow names the first buffer that was too small
+// invalid_buffers is a missing buffer or a negative capacity
+enum class fixed_status
+{
+    ok,
+    segment_overflow,
+    vertex_overflow,
+    triangle_overflow,
+    invalid_buffers,
+};
+
+// Define storage supplied by the caller for a real time calculation
+// nothing is allocated, the buffers are used as they are and never grow
+//     kept       segment_capacity ints, the input indices of the kept segments
+//     offsets    segment_capacity + 1 ints, where the crossings of each kept segment start
+//     crossings  2 * vertex_capacity crossings, each crossing point is stored for both segments
+//     points     vertex_capacity ints, the crossing points sorted for clustering
+//     triangles  triangle_capacity triangles
+// offsets is always needed, the others may be null when their capacity is 0
+// the counts are set by the calculation, on an overflow the triangles
+// found before the buffer filled are still valid
+typedef struct fixed_buffers
+{
+    int* kept = nullptr;
+    int* offsets = nullptr;
+    crossing* crossings = nullptr;
+    int* points = nullptr;
+    triangle* triangles = nullptr;
+    int segment_capacity = 0;
+    int vertex_capacity = 0;
+    int triangle_capacity = 0;
+
+    int segment_count = 0;
+    int vertex_count = 0;
+    int triangle_count = 0;
+} fixed_buffers;
+
+// calculate the triangles of line segments without allocating
+// the same filter as calc_triangles removes non finite, zero length
+// and duplicate segments, but overlapping collinear segments are not merged
+// the crossings are counted and then stored in one pass each over the pairs
+// of kept segments in tiled register blocks with the selected kernel,
+// so the time is bounded by the capacities
+// the crossing points are clustered into vertices like cluster_crossing_points
+// so the triangles are the same as calc_triangles without merging
+// returns ok, invalid_buffers or the first buffer that overflowed
+fixed_status calc_triangles_fixed(const segment_view& segments, fixed_buffers& buffers, const triangle_filter& filter = triangle_filter(),
+    const intersection_kernel kernel = intersection_kernel::branching);
+
+// Define a uniform grid that line segments are added to one at a time
+// cells[N] holds the indices of the segments overlapping cell N
+// the bounds are padded so the grid is only rebuilt when a segment
+// falls outside them or the number of segments doubles
+typedef struct incremental_grid
+{
+    rect bounds = rect(0, 0, 0, 0);
+    int columns = 0;
+    int rows = 0;
+    size_t rebuild_size = 0;
+    std::vector<std::vector<int>> cells;
+} incremental_grid;
+
+// add the last of the line segments to an incremental grid
+// the grid is rebuilt over all the segments when needed
+// so adding a segment takes amortized constant time
+void add_grid_segment(incremental_grid& grid, const std::vector<line_segment>& segments);
+
+// find the line segments of an incremental grid whose bounding box overlaps a rectangle
+// output the indices of the segments in candidates sorted and without duplicates
+void query_incremental_grid(const incremental_grid& grid, const std::vector<line_segment>& segments, const rect& area,
+    std::vector<int>& candidates);
+
+// Define a crossing graph that grows as line segments arrive
+// segments holds the segments kept so far in the order they arrived
+// grid holds the segments kept so far so a new segment is only
+// tested against the segments near it
+// adjacency[N] holds the crossings of segments[N] sorted by segment
+// labels[N] holds the input index of segments[N] counted over all chunks
+// seen holds the segments kept so far so duplicates can be dropped
+// Define crossing points clustered into vertices as they arrive
+// a new point is merged with the points equal to it like cluster_crossing_points
+// points[N] is crossing point N and clusters.find(N) its vertex
+// cells maps a grid cell the size of compare_tolerance to the points in it
+typedef struct vertex_clusters
+{
+    std::vector<point> points;
+    point_clusters clusters = point_clusters(0);
+    std::unordered_map<uint64_t, std::vector<int>> cells;
+} vertex_clusters;
+
+// add a crossing point to growing vertex clusters
+// the points equal to it are found in the 3 by 3 cells around it
+// returns the index of the new point
+int add_vertex_point(vertex_clusters& vertices, const point& pt);
+
+typedef struct triangle_stream
+{
+    std::vector<line_segment> segments;
+    incremental_grid grid;
+    std::vector<std::vector<crossing>> adjacency;
+    std::vector<int> labels;
+    vertex_clusters vertices;
+    std::unordered_map<segment_key, int, segment_key_hash> seen;
+    int received = 0;
+    long long triangle_count = 0;
+} triangle_stream;
+
+// determine if a new line segment should be kept by a stream
+// the same tests as filter_degenerate_segments
+// seen holds the segments kept so far
+bool keep_segment(std::unordered_map<segment_key, int, segment_key_hash>& seen, const line_segment& segment, const int input_index);
+
+// calculate the crossings of a new line segment
+// with the segments kept before it, given the grid they were added to
+// only the segments whose bounding box overlaps the new one are tested
+// the new segment goes second so the points are rounded the same as calc_intersections
+// the crossings are sorted by segment
+void calc_new_crossings(const std::vector<line_segment>& segments, const incremental_grid& grid, const line_segment& segment,
+    std::vector<crossing>& crossings);
+
+// add a new line segment to a growing crossing graph
+// given the crossings of the segment with the segments before it
+// the new segment has the highest index so every list stays sorted
+// the triangles whose last segment is the new one are complete
+// and are visited at once, so every triangle is visited exactly once
+// as soon as its last segment arrives
+// visit is called with the labels of the 3 segments in order
+// and the points in the same order as calc_triangles
+// the crossing points are added to vertices and a triangle needs 3 vertices
+// a triangle is visited when it closes, so one whose points are only joined
+// into a vertex through a chain of points that arrive later is still visited
+template <typename Visit>
+void close_triangles(std::vector<std::vector<crossing>>& adjacency, const std::vector<int>& labels, const std::vector<crossing>& crossings,
+    vertex_clusters& vertices, const triangle_filter& filter, Visit visit)
+{
+    const auto three = static_cast<int>(adjacency.size());
+    adjacency.push_back(crossings);
+    for (auto& edge : adjacency[three])
+    {
+        edge.vertex = add_vertex_point(vertices, edge.pt);
+        adjacency[edge.segment].emplace_back(three, edge.pt);
+        adjacency[edge.segment].back().vertex = edge.vertex;
+    }
+
+    // a triangle one < two < three closes when one and two both cross three
+    // and cross each other, found by merging their lists below three
+    const auto& edges_three = adjacency[three];
+    for (auto edge_one = edges_three.begin(); edge_one != edges_three.end(); ++edge_one)
+    {
+        if (!can_meet(filter, edge_one->pt))
+            continue;
+
+        const auto one = edge_one->segment;
+        const auto& edges_one = adjacency[one];
+        auto edge_two = edge_one + 1;
+        auto edge_onetwo = std::upper_bound(edges_one.begin(), edges_one.end(), one,
+            [](const int value, const crossing& edge) { return value < edge.segment; });
+        while (edge_two != edges_three.end() && edge_onetwo != edges_one.end() && edge_onetwo->segment < three)
+        {
+            if (edge_two->segment < edge_onetwo->segment)
+            {
+                ++edge_two;
+                continue;
+            }
+            if (edge_onetwo->segment < edge_two->segment)
+            {
+                ++edge_onetwo;
+                continue;
+            }
+
+            const auto& point_12 = edge_onetwo->pt;
+            const auto& point_23 = edge_two->pt;
+            const auto& point_31 = edge_one->pt;
+            const auto vertex_12 = vertices.clusters.find(edge_onetwo->vertex);
+            const auto vertex_23 = vertices.clusters.find(edge_two->vertex);
+            const auto vertex_31 = vertices.clusters.find(edge_one->vertex);
+            if (!(vertex_12 == vertex_23 || vertex_23 == vertex_31 || vertex_31 == vertex_12) &&
+                meets(filter, point_12, point_23, point_31))
+            {
+                visit(labels[one], labels[edge_two->segment], labels[three], point_12, point_23, point_31);
+            }
+            ++edge_two;
+            ++edge_onetwo;
+        }
+    }
+}
+
+// add a chunk of line segments to a stream
+// each new segment is filtered like filter_degenerate_segments
+// crossed with every segment kept before it and added to the graph
+// the triangles it completes are visited at once
+// visit is called with the input indices of the 3 segments in order
+// collinear overlapping segments are not merged since a later chunk
+// could overlap a segment whose triangles were already visited
+template <typename Visit>
+void add_segments(triangle_stream& stream, const std::vector<line_segment>& chunk, const triangle_filter& filter, Visit visit)
+{
+    std::vector<crossing> crossings;
+    for (const auto& segment : chunk)
+    {
+        const auto input_index = stream.received++;
+        if (!keep_segment(stream.seen, segment, input_index))
+            continue;
+
+        calc_new_crossings(stream.segments, stream.grid, segment, crossings);
+        stream.segments.push_back(segment);
+        add_grid_segment(stream.grid, stream.segments);
+        stream.labels.push_back(input_index);
+        close_triangles(stream.adjacency, stream.labels, crossings, stream.vertices, filter,
+            [&stream, &visit](const int s1, const int s2, const int s3, const point& p1, const point& p2, const point& p3)
+            {
+                ++stream.triangle_count;
+                visit(s1, s2, s3, p1, p2, p3);
+            });
+    }
+}
+
+// add a chunk of line segments to a stream
+// the triangles completed by the chunk are appended to triangles
+// returns the number of triangles added
+int add_segments(triangle_stream& stream, const std::vector<line_segment>& chunk, std::vector<triangle>& triangles,
+    const triangle_filter& filter = triangle_filter());
+
+// Define a batch of triangles stored as separate coordinate arrays
+// so the geometry of several triangles is calculated with one instruction
+// area, perimeter and degenerate are filled by calc_triangle_geometry
+// area is positive when the points turn counter clockwise
+typedef struct triangle_batch
+{
+    std::vector<float> x1;
+    std::vector<float> y1;
+    std::vector<float> x2;
+    std::vector<float> y2;
+    std::vector<float> x3;
+    std::vector<float> y3;
+    std::vector<float> area;
+    std::vector<float> perimeter;
+    std::vector<uint8_t> degenerate;
+
+    triangle_batch() = default;
+
+    explicit triangle_batch(const std::vector<triangle>& triangles)
+    {
+        for (auto* coords : { &x1, &y1, &x2, &y2, &x3, &y3 })
+            coords->reserve(triangles.size());
+        for (const auto& tri : triangles)
+            push_back(tri);
+    }
+
+    int size() const
+    {
+        return static_cast<int>(x1.size());
+    }
+
+    triangle operator[](const int index) const
+    {
+        return triangle(point(x1[index], y1[index]), point(x2[index], y2[index]), point(x3[index], y3[index]));
+    }
+
+    void push_back(const triangle& tri)
+    {
+        x1.push_back(tri.p1.x);
+        y1.push_back(tri.p1.y);
+        x2.push_back(tri.p2.x);
+        y2.push_back(tri.p2.y);
+        x3.push_back(tri.p3.x);
+        y3.push_back(tri.p3.y);
+    }
+} triangle_batch;
+
+// calculate the geometry of the triangles of a batch
+// from begin up to end one triangle at a time
+void calc_triangle_geometry(triangle_batch& batch, const int begin, const int end);
+
+// calculate the signed area, perimeter and degeneracy of every triangle of a batch
+// a triangle is degenerate when its area is below compare_tolerance
+// the batch is processed 8 or 4 triangles at a time with vector instructions
+void calc_triangle_geometry(triangle_batch& batch);
+
+// remove the degenerate triangles from a vector of triangles
+// the geometry is calculated for the whole vector as one batch
+// and the triangles that are kept are moved down in a single pass
+// returns the number of triangles removed
+int remove_degenerate_triangles(std::vector<triangle>& triangles);
+
+// Define a uniform grid over the bounding boxes of line segments
+// the segments overlapping cell N are
+// indices[cell_start[N]] up to indices[cell_start[N + 1]]
+typedef struct segment_grid
+{
+    rect bounds = rect(0, 0, 0, 0);
+    int columns = 0;
+    int rows = 0;
+    std::vector<int> cell_start;
+    std::vector<int> indices;
+} segment_grid;
+
+// calculate the bounding box of a line segment
+rect calc_bounds(const line_segment& segment);
+
+// calculate the range of cells covered by a rectangle
+// given the bounds and the number of columns and rows of a grid
+// the range is clamped to the grid
+void calc_cell_range(const rect& bounds, const int columns, const int rows, const rect& area,
+    int& first_column, int& first_row, int& last_column, int& last_row);
+
+// calculate the range of grid cells covered by a rectangle
+// the range is clamped to the grid
+void calc_cell_range(const segment_grid& grid, const rect& area, int& first_column, int& first_row, int& last_column, int& last_row);
+
+// build a uniform grid over line segments
+// the grid has about one cell per segment
+// every segment is added to each cell its bounding box overlaps
+void build_segment_grid(const segment_view& segments, segment_grid& grid);
+
+// find the line segments whose bounding box overlaps a rectangle
+// given the grid built over the segments
+// output the indices of the segments in candidates sorted and without duplicates
+void query_segment_grid(const segment_grid& grid, const segment_view& segments, const rect& area, std::vector<int>& candidates);
+
+// clip a line segment to a rectangle
+// from https://en.wikipedia.org/wiki/Liang%E2%80%93Barsky_algorithm
+// if part of the segment is inside the rectangle return it in clipped
+bool clip_segment(const line_segment& segment, const rect& area, line_segment& clipped);
+
+// calculate the triangles inside a rectangle
+// given the line segments and the grid built over them
+// the segments overlapping the rectangle are found with the grid
+// and clipped to it before calculating the triangles
+// only triangles with all 3 points inside the rectangle are output
+// the points are calculated from the clipped segments so they can
+// differ from calc_triangles over the whole scene by rounding
+int calc_triangles_in_rect(const segment_view& segments, const segment_grid& grid, const rect& area, std::vector<triangle>& triangles);
+
+// calculate the triangles inside a rectangle
+// builds the grid for a single query
+// keep a segment_grid and call the overload above for repeated queries
+int calc_triangles_in_rect(const segment_view& segments, const rect& area, std::vector<triangle>& triangles);
+
+// number of children of a node in the triangle index
+static constexpr int index_node_size = 16;
+
+// Define a node of the triangle index
+// a leaf holds the triangles items[first] up to items[first + count]
+// any other node holds the nodes nodes[first] up to nodes[first + count]
+typedef struct index_node
+{
+    rect bounds;
+    int first;
+    int count;
+
+    index_node(const rect& bounds, const int first, const int count)
+        : bounds(bounds),
+        first(first),
+        count(count)
+    {}
+} index_node;
+
+// Define a packed R-tree over the bounding boxes of triangles
+// the nodes are stored one level after another starting with the leaves
+// nodes[0] up to nodes[leaf_count] are the leaves and the root is last
+typedef struct triangle_index
+{
+    std::vector<index_node> nodes;
+    std::vector<int> items;
+    int leaf_count = 0;
+} triangle_index;
+
+// calculate the bounding box of a triangle
+rect calc_bounds(const triangle& tri);
+
+// calculate the smallest rectangle containing 2 rectangles
+rect calc_bounds(const rect& a, const rect& b);
+
+// sort boxes in sort tile recursive order
+// the boxes are sorted by the x of their center and cut into vertical slices
+// each slice is sorted by the y of its center so that every run of
+// index_node_size boxes covers a compact tile
+// order will output the indices of the boxes in that order
+void calc_tile_order(const std::vector<rect>& boxes, std::vector<int>& order);
+
+// pack boxes into the nodes of one level of the triangle index
+// given the boxes in tile order, every run of index_node_size boxes becomes a node
+// the children of a node start at first in the level below
+void pack_level(const std::vector<rect>& boxes, const std::vector<int>& order, const int first, std::vector<index_node>& nodes);
+
+// build a packed R-tree over bounding boxes with sort tile recursive bulk loading
+// the leaves are built over the boxes in tile order
+// every level above is built over the level below in tile order
+// until a single root is left
+// the items of the index are the indices of the boxes
+void build_box_index(std::vector<rect> boxes, triangle_index& index);
+
+// build a packed R-tree over triangles
+void build_triangle_index(const std::vector<triangle>& triangles, triangle_index& index);
+
+// visit the triangles of the index whose bounding box overlaps a rectangle
+template <typename Visit>
+void visit_triangle_index(const triangle_index& index, const rect& area, Visit visit)
+{
+    if (index.nodes.empty())
+        return;
+
+    std::vector<int> stack;
+    stack.push_back(static_cast<int>(index.nodes.size()) - 1);
+    while (!stack.empty())
+    {
+        const auto& node = index.nodes[stack.back()];
+        stack.pop_back();
+        if (!node.bounds.overlaps(area))
+            continue;
+
+        const auto leaf = &node - index.nodes.data() < index.leaf_count;
+        for (auto k = node.first; k < node.first + node.count; ++k)
+        {
+            if (leaf)
+                visit(index.items[k]);
+            else
+                stack.push_back(k);
+        }
+    }
+}
+
+// determine if a point is inside a triangle
+// a point on an edge is inside
+bool contains_point(const triangle& tri, const point& pt);
+
+// determine if a triangle overlaps a rectangle
+// either an edge of the triangle crosses the rectangle
+// or the rectangle is inside the triangle
+bool overlaps(const triangle& tri, const rect& area);
+
+// find the triangles containing a point
+// given the triangles and the index built over them
+// output the indices of the triangles in found
+void query_triangles_at(const triangle_index& index, const std::vector<triangle>& triangles, const point& pt, std::vector<int>& found);
+
+// find the triangles overlapping a rectangle
+// given the triangles and the index built over them
+// output the indices of the triangles in found
+void query_triangles_in(const triangle_index& index, const std::vector<triangle>& triangles, const rect& area, std::vector<int>& found);
+
+// calculate the sign of (a - b) * (c - d) - (e - f) * (g - h) exactly
+// every product of 2 floats fits in a double so the determinant is
+// the exact sum of 8 doubles, added up as a nonoverlapping expansion
+// returns -1, 0 or 1
+int calc_exact_sign(float a, float b, float c, float d, float e, float f, float g, float h);
+
+// calculate the sign of (a - b) * (c - d) - (e - f) * (g - h)
+// in doubles first and exactly only when the rounding error could change the sign
+int calc_filtered_sign(float a, float b, float c, float d, float e, float f, float g, float h);
+
+// calculate the intersection of 2 line segments with exact crossing tests
+// touching segments intersect and parallel or collinear segments do not
+// the point itself is calculated in doubles
+bool calc_intersection_exact(const line_segment& ls1, const line_segment& ls2, point& pt);
+
+// calculate the intersection of 2 line segments with filtered crossing tests
+// gives the same answer as calc_intersection_exact
+bool calc_intersection_filtered(const line_segment& ls1, const line_segment& ls2, point& pt);
+
+// Define the broad phase policies of triangle_engine
+// each calls pair(a, b) with a < b once for every pair of segments
+// that may cross, leaving the crossing test to the kernel
+
+// every pair is tested
+typedef struct all_pairs
+{
+    template <typename Pair>
+    void operator()(const std::vector<line_segment>& segments, Pair pair) const
+    {
+        const auto num_line_segments = static_cast<int>(segments.size());
+        for (auto a = 0; a < num_line_segments; ++a)
+            for (auto b = a + 1; b < num_line_segments; ++b)
+                pair(a, b);
+    }
+} all_pairs;
+
+// pairs sharing a cell of a uniform grid are tested
+// a pair is tested in the first cell both bounding boxes overlap
+typedef struct grid_pairs
+{
+    template <typename Pair>
+    void operator()(const std::vector<line_segment>& segments, Pair pair) const
+    {
+        segment_grid grid;
+        build_segment_grid(segments, grid);
+
+        std::vector<rect> bounds;
+        std::vector<int> first_cell;
+        bounds.reserve(segments.size());
+        first_cell.reserve(segments.size() * 2);
+        for (const auto& segment : segments)
+        {
+            int first_column, first_row, last_column, last_row;
+            bounds.push_back(calc_bounds(segment));
+            calc_cell_range(grid, bounds.back(), first_column, first_row, last_column, last_row);
+            first_cell.push_back(first_column);
+            first_cell.push_back(first_row);
+        }
+
+        for (auto row = 0; row < grid.rows; ++row)
+        {
+            for (auto column = 0; column < grid.columns; ++column)
+            {
+                const auto cell = row * grid.columns + column;
+                for (auto j = grid.cell_start[cell]; j < grid.cell_start[cell + 1]; ++j)
+                {
+                    for (auto k = j + 1; k < grid.cell_start[cell + 1]; ++k)
+                    {
+                        const auto a = std::min(grid.indices[j], grid.indices[k]);
+                        const auto b = std::max(grid.indices[j], grid.indices[k]);
+                        if (std::max(first_cell[2 * a], first_cell[2 * b]) == column &&
+                            std::max(first_cell[2 * a + 1], first_cell[2 * b + 1]) == row &&
+                            bounds[a].overlaps(bounds[b]))
+                        {
+                            pair(a, b);
+                        }
+                    }
+                }
+            }
+        }
+    }
+} grid_pairs;
+
+// pairs whose bounding boxes overlap are found by sweeping along x
+// the segments are sorted by their lowest x and each is paired with
+// the segments that start before it ends
+typedef struct sweep_pairs
+{
+    template <typename Pair>
+    void operator()(const std::vector<line_segment>& segments, Pair pair) const
+    {
+        std::vector<rect> bounds;
+        bounds.reserve(segments.size());
+        for (const auto& segment : segments)
+            bounds.push_back(calc_bounds(segment));
+
+        std::vector<int> order(segments.size());
+        for (auto i = 0; i < static_cast<int>(order.size()); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&bounds](const int a, const int b) { return bounds[a].min_x < bounds[b].min_x; });
+
+        for (auto j = 0; j < static_cast<int>(order.size()); ++j)
+        {
+            const auto& box = bounds[order[j]];
+            for (auto k = j + 1; k < static_cast<int>(order.size()) && bounds[order[k]].min_x <= box.max_x; ++k)
+            {
+                if (box.overlaps(bounds[order[k]]))
+                    pair(std::min(order[j], order[k]), std::max(order[j], order[k]));
+            }
+        }
+    }
+} sweep_pairs;
+
+// pairs whose bounding boxes overlap are found with a packed R-tree
+// over the bounding boxes, each segment queries for the segments after it
+typedef struct tree_pairs
+{
+    template <typename Pair>
+    void operator()(const std::vector<line_segment>& segments, Pair pair) const
+    {
+        std::vector<rect> bounds;
+        bounds.reserve(segments.size());
+        for (const auto& segment : segments)
+            bounds.push_back(calc_bounds(segment));
+
+        triangle_index index;
+        build_box_index(bounds, index);
+        for (auto a = 0; a < static_cast<int>(segments.size()); ++a)
+        {
+            visit_triangle_index(index, bounds[a], [&](const int b)
+            {
+                if (b > a && bounds[a].overlaps(bounds[b]))
+                    pair(a, b);
+            });
+        }
+    }
+} tree_pairs;
+
+// Define the narrow phase policies of triangle_engine
+// each calculates the intersection of 2 line segments like calc_intersection
+
+// float arithmetic with a tolerance, the same as calc_triangles
+typedef struct float_kernel
+{
+    bool operator()(const line_segment& ls1, const line_segment& ls2, point& pt) const
+    {
+        return calc_intersection(ls1, ls2, pt);
+    }
+} float_kernel;
+
+// exact crossing tests on every pair
+typedef struct exact_kernel
+{
+    bool operator()(const line_segment& ls1, const line_segment& ls2, point& pt) const
+    {
+        return calc_intersection_exact(ls1, ls2, pt);
+    }
+} exact_kernel;
+
+// double crossing tests with an exact fallback near the error bound
+typedef struct filtered_kernel
+{
+    bool operator()(const line_segment& ls1, const line_segment& ls2, point& pt) const
+    {
+        return calc_intersection_filtered(ls1, ls2, pt);
+    }
+} filtered_kernel;
+
+// number the crossing points of a crossing graph by a key
+// crossings whose points have the same key share a vertex id
+// key_of maps a point to 64 bits
+// returns the number of vertices
+template <typename KeyOf>
+int number_crossing_points(crossing_graph& graph, const KeyOf& key_of)
+{
+    std::unordered_map<uint64_t, int> vertex_of;
+    for (auto& edges : graph.adjacency)
+    {
+        for (auto& edge : edges)
+        {
+            const auto vertex = static_cast<int>(vertex_of.size());
+            edge.vertex = vertex_of.emplace(key_of(edge.pt), vertex).first->second;
+        }
+    }
+    return static_cast<int>(vertex_of.size());
+}
+
+// pack the exact bits of a point into 64 bits
+// adding 0 turns -0 into 0 so both give the same bits
+inline uint64_t point_bits(const point& pt)
+{
+    const float coords[2] = { pt.x + 0.0f, pt.y + 0.0f };
+    uint32_t bits[2];
+    std::memcpy(bits, coords, sizeof(bits));
+    return static_cast<uint64_t>(bits[0]) << 32 | bits[1];
+}
+
+// Define the duplicate policies of triangle_engine
+// each decides which crossing points are the same vertex of the crossing graph
+// and gives every crossing the id of its vertex
+// the adjacency lists are sorted by segment when it is called
+
+// crossing points are the same vertex only when their bits are the same
+typedef struct exact_dedup
+{
+    int operator()(crossing_graph& graph) const
+    {
+        return number_crossing_points(graph, point_bits);
+    }
+} exact_dedup;
+
+// crossing points equal within compare_tolerance are clustered through a hash
+// of their grid cells, the same as calc_triangles
+typedef struct hash_dedup
+{
+    int operator()(crossing_graph& graph) const
+    {
+        return cluster_crossing_points(graph);
+    }
+} hash_dedup;
+
+// crossing points are snapped to a grid of the given cell size
+// and the points that snap to the same point are the same vertex
+// points closer than a cell can still fall on both sides of a cell edge
+typedef struct snap_dedup
+{
+    float cell = static_cast<float>(compare_tolerance);
+
+    int operator()(crossing_graph& graph) const
+    {
+        const auto size = cell;
+        return number_crossing_points(graph, [size](const point& pt)
+        {
+            return point_bits(point(static_cast<float>(std::round(pt.x / size) * size),
+                static_cast<float>(std::round(pt.y / size) * size)));
+        });
+    }
+} snap_dedup;
+
+// Define the output sinks of triangle_engine
+// a sink is called like a visitor of visit_triangles
+// any function object taking (s1, s2, s3, p1, p2, p3) is a callback sink
+
+// append the triangles to a vector
+typedef struct vector_sink
+{
+    std::vector<triangle>& triangles;
+
+    explicit vector_sink(std::vector<triangle>& triangles)
+        : triangles(triangles)
+    {}
+
+    void operator()(int, int, int, const point& p1, const point& p2, const point& p3) const
+    {
+        triangles.emplace_back(p1, p2, p3);
+    }
+} vector_sink;
+
+// count the triangles without keeping them
+typedef struct counter_sink
+{
+    long long count = 0;
+
+    void operator()(int, int, int, const point&, const point&, const point&)
+    {
+        ++count;
+    }
+} counter_sink;
+
+// calculate the crossing graph of line segments from the pairs a broad phase gives a kernel
+// the lower index goes first so the points are rounded the same as calc_intersections
+// graph.adjacency[N] will output the crossings of segments[N] sorted by segment
+// and the dedup policy gives the crossings their vertex ids
+// graph.labels is left as it is
+template <typename BroadPhase, typename Kernel, typename Dedup>
+void calc_crossing_graph(const std::vector<line_segment>& segments, const BroadPhase& broad_phase, const Kernel& kernel,
+    const Dedup& dedup, crossing_graph& graph)
+{
+    graph.adjacency.clear();
+    graph.adjacency.resize(segments.size());
+    broad_phase(segments, [&](const int a, const int b)
+    {
+        point intersect_pt(0, 0);
+        if (kernel(segments[a], segments[b], intersect_pt))
+        {
+            graph.adjacency[a].emplace_back(b, intersect_pt);
+            graph.adjacency[b].emplace_back(a, intersect_pt);
+        }
+    });
+    for (auto& edges : graph.adjacency)
+        std::sort(edges.begin(), edges.end(), [](const crossing& a, const crossing& b) { return a.segment < b.segment; });
+    dedup(graph);
+}
+
+// Define a triangle calculation composed from policies at compile time
+//     BroadPhase  all_pairs, grid_pairs, sweep_pairs or tree_pairs
+//     Kernel      float_kernel, exact_kernel or filtered_kernel
+//     Dedup       exact_dedup, hash_dedup or snap_dedup
+// run filters non finite, zero length and duplicate segments like calc_triangles,
+// builds the crossing graph from the pairs the broad phase gives the kernel,
+// lets the dedup policy decide which crossing points are the same vertex
+// and passes the triangles to the sink in the order of calc_triangles
+// the sink may be a temporary such as a lambda
+// overlapping collinear segments are not merged
+template <typename BroadPhase, typename Kernel, typename Dedup>
+struct triangle_engine
+{
+    BroadPhase broad_phase;
+    Kernel kernel;
+    Dedup dedup;
+
+    template <typename Sink>
+    void run(const segment_view& segments, Sink&& sink, const triangle_filter& filter = triangle_filter()) const
+    {
+        crossing_graph graph;
+        std::unordered_map<segment_key, int, segment_key_hash> seen;
+        seen.reserve(segments.size());
+        for (auto i = 0; i < static_cast<int>(segments.size()); ++i)
+        {
+            if (keep_segment(seen, segments[i], i))
+                graph.labels.push_back(i);
+        }
+
+        std::vector<line_segment> kept;
+        kept.reserve(graph.labels.size());
+        for (const auto index : graph.labels)
+            kept.push_back(segments[index]);
+
+        calc_crossing_graph(kept, broad_phase, kernel, dedup, graph);
+
+        visit_triangles(graph, 0, static_cast<int>(kept.size()), filter,
+            [&sink](const int s1, const int s2, const int s3, const point& p1, const point& p2, const point& p3)
+            {
+                sink(s1, s2, s3, p1, p2, p3);
+            });
+    }
+};
+
+// Define a bounded lock free queue between one producer and one consumer thread
+// head is only written by the consumer and tail only by the producer
+// the producer waits while the queue is full so a slow consumer
+// slows the producer down instead of growing memory
+// a capacity of 0 is raised to 1 so a push can always complete
+template <typename T>
+struct spsc_queue
+{
+    std::vector<T> slots;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<bool> closed;
+
+    explicit spsc_queue(const size_t capacity)
+        : slots(std::max<size_t>(capacity, 1) + 1),
+        head(0),
+        tail(0),
+        closed(false)
+    {}
+
+    bool try_push(T& item)
+    {
+        const auto position = tail.load(std::memory_order_relaxed);
+        const auto next = (position + 1) % slots.size();
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+
+        slots[position] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& item)
+    {
+        const auto position = head.load(std::memory_order_relaxed);
+        if (position == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(slots[position]);
+        head.store((position + 1) % slots.size(), std::memory_order_release);
+        return true;
+    }
+
+    // wait for room and push an item
+    void push(T item)
+    {
+        while (!try_push(item))
+            std::this_thread::yield();
+    }
+
+    // wait for an item and pop it
+    // returns false once the queue is closed and empty
+    bool pop(T& item)
+    {
+        while (!try_pop(item))
+        {
+            if (closed.load(std::memory_order_acquire))
+                return try_pop(item);
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    // called by the producer after its last push
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+    }
+};
+
+// Define a bounded lock free queue from many producer threads to one consumer thread
+// from http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+// each slot has a sequence number that says whether it is free for
+// the producer at that position or full for the consumer
+// producers claim a position by advancing tail and publish the item
+// by advancing the sequence of its slot
+// the capacity is rounded up to a power of 2
+// producers wait while the queue is full so a slow consumer
+// slows the producers down instead of growing memory
+template <typename T>
+struct mpsc_queue
+{
+    struct slot
+    {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    std::unique_ptr<slot[]> slots;
+    size_t mask;
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+    std::atomic<bool> closed;
+
+    explicit mpsc_queue(const size_t capacity)
+        : mask(0),
+        head(0),
+        tail(0),
+        closed(false)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+
+        mask = size - 1;
+        slots.reset(new slot[size]);
+        for (size_t i = 0; i < size; ++i)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool try_push(T& item)
+    {
+        auto position = tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto& cell = slots[position & mask];
+            const auto sequence = cell.sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0)
+            {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.item = std::move(item);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+                return false;
+            else
+                position = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool try_pop(T& item)
+    {
+        const auto position = head.load(std::memory_order_relaxed);
+        auto& cell = slots[position & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != position + 1)
+            return false;
+
+        item = std::move(cell.item);
+        cell.sequence.store(position + mask + 1, std::memory_order_release);
+        head.store(position + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // wait for room and push an item
+    void push(T item)
+    {
+        while (!try_push(item))
+            std::this_thread::yield();
+    }
+
+    // wait for an item and pop it
+    // returns false once the queue is closed and empty
+    bool pop(T& item)
+    {
+        while (!try_pop(item))
+        {
+            if (closed.load(std::memory_order_acquire))
+                return try_pop(item);
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    // called once every producer has made its last push
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+    }
+};
+
+// number of triangles pushed to a queue at a time
+static constexpr size_t queue_batch = 256;
+
+// calculate the triangles of line segments into a queue
+// so a consumer thread can process them while they are being found
+// the triangles are pushed in batches of up to queue_batch
+// the first segments are split between thread_count threads that
+// all push to the queue, so use an mpsc_queue unless thread_count is 1
+// the threads wait while the queue is full
+// the queue is closed when every triangle has been pushed
+// thread_count 0 uses one thread per core
+// returns the number of triangles pushed
+template <typename Queue>
+long long calc_triangles(const segment_view& segments, Queue& queue, const int thread_count = 0,
+    const triangle_filter& filter = triangle_filter())
+{
+    crossing_graph graph;
+    prepare_crossing_graph(segments, graph);
+
+    std::atomic<long long> count(0);
+    run_in_chunks(static_cast<int>(graph.adjacency.size()), thread_count, [&](int, const int first, const int last)
+    {
+        std::vector<triangle> batch;
+        long long found = 0;
+        visit_triangles(graph, first, last, filter, [&](int, int, int, const point& p1, const point& p2, const point& p3)
+        {
+            batch.emplace_back(p1, p2, p3);
+            if (batch.size() == queue_batch)
+            {
+                found += static_cast<long long>(batch.size());
+                queue.push(std::move(batch));
+                batch = std::vector<triangle>();
+            }
+        });
+
+        if (!batch.empty())
+        {
+            found += static_cast<long long>(batch.size());
+            queue.push(std::move(batch));
+        }
+        count += found;
+    });
+
+    queue.close();
+    return count;
+}
+
+// Define a fixed pool of worker threads running queued tasks
+// the threads wait on a condition variable while there is no work
+// an exception of a task is passed to the submitter through its future
+// the destructor finishes the queued tasks before joining the threads
+typedef struct task_pool
+{
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable ready;
+    bool stopping = false;
+
+    explicit task_pool(int thread_count = 0)
+    {
+        if (thread_count <= 0)
+            thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+        for (auto worker = 0; worker < thread_count; ++worker)
+        {
+            threads.emplace_back([this]
+            {
+                for (;;)
+                {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        ready.wait(guard, [this] { return stopping || !tasks.empty(); });
+                        if (tasks.empty())
+                            return;
+
+                        task = std::move(tasks.front());
+                        tasks.pop_front();
+                    }
+
+                    // submit wraps every task so its exceptions go to its future
+                    task();
+                }
+            });
+        }
+    }
+
+    ~task_pool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto& worker : threads)
+            worker.join();
+    }
+
+    task_pool(const task_pool&) = delete;
+    task_pool& operator=(const task_pool&) = delete;
+
+    // queue a task for the next free thread
+    // returns a future that is ready when the task has run
+    // and holds the exception when the task threw
+    std::future<void> submit(std::function<void()> task)
+    {
+        auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+        auto done = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tasks.push_back([packaged] { (*packaged)(); });
+        }
+        ready.notify_one();
+        return done;
+    }
+} task_pool;
+
+// the pool the asynchronous calculations run on
+// created with one thread per core the first time it is used
+task_pool& shared_pool();
+
+// Define the options of an asynchronous calculation
+// cancel can be set from any thread to stop the calculation early
+// at most max_triangles triangles are kept
+typedef struct async_options
+{
+    triangle_filter filter;
+    std::shared_ptr<std::atomic<bool>> cancel = std::make_shared<std::atomic<bool>>(false);
+    size_t max_triangles = std::numeric_limits<size_t>::max();
+} async_options;
+
+// Define what a calculation did
+// segments is the number of input segments
+// kept_segments is the number of segments left after filtering and merging
+// crossings is the number of pairs of segments that cross
+typedef struct run_stats
+{
+    size_t segments = 0;
+    size_t kept_segments = 0;
+    size_t crossings = 0;
+    size_t triangles = 0;
+    double prepare_ms = 0;
+    double enumerate_ms = 0;
+} run_stats;
+
+// Define the result of an asynchronous calculation
+// partial is true when it was cancelled or stopped at max_triangles
+// and triangles only holds the triangles found until then
+// error holds the exception when the calculation failed
+// and then the rest of the result is empty
+typedef struct triangle_result
+{
+    std::vector<triangle> triangles;
+    run_stats stats;
+    bool cancelled = false;
+    bool truncated = false;
+    bool partial = false;
+    std::exception_ptr error;
+} triangle_result;
+
+// calculate the triangles of line segments for an asynchronous caller
+// the cancel flag is checked between tiles of the pair loop
+// and between chunks of first segments
+void calc_triangles(const segment_view& segments, const async_options& options, triangle_result& result);
+
+// calculate the triangles of line segments on the shared pool
+// the segments are moved into the task so the caller does not have to keep them
+// done is called on a pool thread with the result
+// a calculation that throws gives done a result with only the error set
+// an event loop would post the result back to its own thread from done
+void calc_triangles_async(std::vector<line_segment> segments, const async_options& options, std::function<void(triangle_result)> done);
+
+// calculate the triangles of line segments on the shared pool
+// returns a future that is ready with the result
+// or holds the exception of a failed calculation
+std::future<triangle_result> calc_triangles_async(std::vector<line_segment> segments, const async_options& options = async_options());
+
+#if defined(FIND_TRIANGLES_COROUTINES)
+// Define an awaitable calculation of triangles
+// co_await submits the calculation to the shared pool
+// and the coroutine resumes on the pool thread with the result
+typedef struct triangle_awaitable
+{
+    std::vector<line_segment> segments;
+    async_options options;
+    triangle_result result;
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> waiting)
+    {
+        calc_triangles_async(std::move(segments), options, [this, waiting](triangle_result done)
+        {
+            result = std::move(done);
+            waiting.resume();
+        });
+    }
+
+    // a failed calculation throws its exception into the coroutine
+    triangle_result await_resume()
+    {
+        if (result.error)
+            std::rethrow_exception(result.error);
+        return std::move(result);
+    }
+} triangle_awaitable;
+
+// calculate the triangles of line segments with co_await
+triangle_awaitable calc_triangles_awaitable(std::vector<line_segment> segments, const async_options& options = async_options());
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+// ReSharper disable CppInconsistentNaming
+#ifndef FIND_TRIANGLES_C_H
+#define FIND_TRIANGLES_C_H
+
+// C interface to the triangle finder
+// for callers that are not written in C++
+//
+// a context owns the results of the last calculation
+// a context must only be used by one thread at a time
+// but different contexts can be used at the same time
+//
+// segments are read straight from the caller's memory
+// segments points at x1 of the first segment
+// each segment is 4 floats x1, y1, x2, y2 one after another
+// stride is the number of bytes from one segment to the next
+// so segments can be interleaved with other data
+//
+// results are copied into buffers owned by the caller
+// ft_find_triangles returns the number of triangles so the caller
+// can size a buffer before calling ft_copy_triangles
+
+#include <stddef.h>
+
+#if defined(_WIN32) && defined(FIND_TRIANGLES_DLL)
+#define FT_API __declspec(dllexport)
+#else
+#define FT_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ft_context ft_context;
+
+typedef enum ft_status
+{
+    FT_OK = 0,
+    FT_INVALID_ARGUMENT = 1,
+    FT_BUFFER_TOO_SMALL = 2,
+    FT_OUT_OF_MEMORY = 3,
+    FT_INTERNAL_ERROR = 4
+} ft_status;
+
+typedef struct ft_triangle
+{
+    float x1;
+    float y1;
+    float x2;
+    float y2;
+    float x3;
+    float y3;
+} ft_triangle;
+
+// create a context
+// returns NULL when out of memory
+FT_API ft_context* ft_create(void);
+
+// destroy a context and the results it holds
+FT_API void ft_destroy(ft_context* context);
+
+// find the triangles of line segments
+// the triangles are kept in the context until the next calculation
+// triangle_count will output the number of triangles found
+FT_API ft_status ft_find_triangles(ft_context* context, const float* segments, size_t stride, size_t count, size_t* triangle_count);
+
+// copy the triangles of the last calculation into a caller buffer
+// returns FT_BUFFER_TOO_SMALL and copies nothing when capacity is too small
+// written will output the number of triangles copied
+FT_API ft_status ft_copy_triangles(const ft_context* context, ft_triangle* triangles, size_t capacity, size_t* written);
+
+// count the triangles each line segment is part of
+// counts must have room for count values
+FT_API ft_status ft_count_segment_triangles(ft_context* context, const float* segments, size_t stride, size_t count, long long* counts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,428 @@
+// ReSharper disable CppInconsistentNaming
+#include "FindTriangles.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// Define the formats triangles can be written in
+//     text  (x1, y1), (x2, y2), (x3, y3) with a heading and a count
+//     csv   x1,y1,x2,y2,x3,y3 and nothing else
+enum class output_format
+{
+    text,
+    csv,
+};
+
+// Define the engines the command line can run
+//     pipeline  parse, cross, enumerate and write at the same time
+//     batch     read every segment then calculate the triangles at once
+//     stream    read chunks of segments and add each to a growing graph
+enum class engine_kind
+{
+    pipeline,
+    batch,
+    stream,
+};
+
+// Define the options given on the command line
+typedef struct cli_options
+{
+    engine_kind engine = engine_kind::pipeline;
+    output_format format = output_format::text;
+    size_t chunk_size = 1024;
+    string input;
+} cli_options;
+
+// parse a line segment from a line of text
+// the 4 coordinates x1 y1 x2 y2 are separated by spaces, tabs or commas
+// blank lines and lines starting with # are skipped
+bool parse_segment(const string& line, line_segment& segment)
+{
+    const auto* text = line.c_str();
+    while (*text == ' ' || *text == '\t')
+        ++text;
+    if (*text == '\0' || *text == '#' || *text == '\r')
+        return false;
+
+    float coords[4];
+    for (auto& coord : coords)
+    {
+        while (*text == ' ' || *text == '\t' || *text == ',')
+            ++text;
+
+        char* end;
+        coord = strtof(text, &end);
+        if (end == text)
+            return false;
+        text = end;
+    }
+    segment = line_segment(coords[0], coords[1], coords[2], coords[3]);
+    return true;
+}
+
+// read every line segment from a stream
+void read_segments(istream& input, vector<line_segment>& segments)
+{
+    string line;
+    line_segment segment(0, 0, 0, 0);
+    while (getline(input, line))
+    {
+        if (parse_segment(line, segment))
+            segments.push_back(segment);
+    }
+}
+
+// write the points of a triangle
+void write_triangle(ostream& output, const triangle& triangle, const output_format format)
+{
+    if (format == output_format::csv)
+    {
+        output <<
+            triangle.p1.x << ',' << triangle.p1.y << ',' <<
+            triangle.p2.x << ',' << triangle.p2.y << ',' <<
+            triangle.p3.x << ',' << triangle.p3.y;
+        return;
+    }
+
+    output <<
+        "(" << setw(3) << triangle.p1.x << ", " << setw(3) << triangle.p1.y << "), " <<
+        "(" << setw(3) << triangle.p2.x << ", " << setw(3) << triangle.p2.y << "), " <<
+        "(" << setw(3) << triangle.p3.x << ", " << setw(3) << triangle.p3.y << ")";
+}
+
+// write a batch of triangles one per line
+void write_triangles(ostream& output, const vector<triangle>& triangles, const output_format format)
+{
+    for (const auto& triangle : triangles)
+    {
+        write_triangle(output, triangle, format);
+        output << '\n';
+    }
+}
+
+// Define a chunk of kept line segments with their crossings
+// labels[N] is the input index of the Nth segment
+// crossings[N] are its crossings with the segments kept before it
+typedef struct crossing_chunk
+{
+    vector<int> labels;
+    vector<vector<crossing>> crossings;
+} crossing_chunk;
+
+// find the triangles of line segments read from a stream
+// the work is split in 4 stages running at the same time
+// connected by bounded lock free queues of chunks
+//     parse      read lines of text into chunks of segments
+//     cross      filter each segment and cross it with the nearby segments before it
+//     enumerate  add the crossings to the graph and find the triangles they close
+//     write      format the triangles and write them to the output
+// each triangle is written as soon as its last segment has been crossed
+// returns the number of triangles written
+long long run_pipeline(istream& input, ostream& output, const output_format format, const size_t chunk_size,
+    const size_t queue_size = 16, const triangle_filter& filter = triangle_filter())
+{
+    spsc_queue<vector<line_segment>> parsed(queue_size);
+    spsc_queue<crossing_chunk> crossed(queue_size);
+    spsc_queue<vector<triangle>> found(queue_size);
+
+    thread parse([&]
+    {
+        vector<line_segment> chunk;
+        string line;
+        line_segment segment(0, 0, 0, 0);
+        while (getline(input, line))
+        {
+            if (!parse_segment(line, segment))
+                continue;
+
+            chunk.push_back(segment);
+            if (chunk.size() == chunk_size)
+            {
+                parsed.push(move(chunk));
+                chunk = vector<line_segment>();
+            }
+        }
+        if (!chunk.empty())
+            parsed.push(move(chunk));
+        parsed.close();
+    });
+
+    thread cross([&]
+    {
+        vector<line_segment> segments;
+        incremental_grid grid;
+        unordered_map<segment_key, int, segment_key_hash> seen;
+        vector<line_segment> chunk;
+        auto received = 0;
+        while (parsed.pop(chunk))
+        {
+            crossing_chunk out;
+            for (const auto& segment : chunk)
+            {
+                const auto input_index = received++;
+                if (!keep_segment(seen, segment, input_index))
+                    continue;
+
+                out.labels.push_back(input_index);
+                out.crossings.emplace_back();
+                calc_new_crossings(segments, grid, segment, out.crossings.back());
+                segments.push_back(segment);
+                add_grid_segment(grid, segments);
+            }
+            crossed.push(move(out));
+        }
+        crossed.close();
+    });
+
+    thread enumerate([&]
+    {
+        vector<vector<crossing>> adjacency;
+        vector<int> labels;
+        vertex_clusters vertices;
+        crossing_chunk chunk;
+        vector<triangle> batch;
+        while (crossed.pop(chunk))
+        {
+            for (size_t k = 0; k < chunk.labels.size(); ++k)
+            {
+                labels.push_back(chunk.labels[k]);
+                close_triangles(adjacency, labels, chunk.crossings[k], vertices, filter,
+                    [&batch](int, int, int, const point& p1, const point& p2, const point& p3)
+                    {
+                        batch.emplace_back(p1, p2, p3);
+                    });
+
+                if (batch.size() >= chunk_size)
+                {
+                    found.push(move(batch));
+                    batch = vector<triangle>();
+                }
+            }
+        }
+        if (!batch.empty())
+            found.push(move(batch));
+        found.close();
+    });
+
+    long long count = 0;
+    vector<triangle> batch;
+    while (found.pop(batch))
+    {
+        for (const auto& triangle : batch)
+        {
+            write_triangle(output, triangle, format);
+            output << '\n';
+        }
+        count += static_cast<long long>(batch.size());
+    }
+
+    parse.join();
+    cross.join();
+    enumerate.join();
+    output.flush();
+    return count;
+}
+
+// find the triangles of line segments read from a stream with the chosen engine
+// returns the number of triangles written
+long long run_engine(istream& input, ostream& output, const cli_options& options)
+{
+    switch (options.engine)
+    {
+    case engine_kind::batch:
+    {
+        vector<line_segment> segments;
+        read_segments(input, segments);
+
+        vector<triangle> triangles;
+        calc_triangles(segments, triangles);
+        write_triangles(output, triangles, options.format);
+        output.flush();
+        return static_cast<long long>(triangles.size());
+    }
+    case engine_kind::stream:
+    {
+        triangle_stream stream;
+        vector<line_segment> chunk;
+        vector<triangle> triangles;
+        string line;
+        line_segment segment(0, 0, 0, 0);
+        auto more = true;
+        while (more)
+        {
+            more = static_cast<bool>(getline(input, line));
+            if (more && parse_segment(line, segment))
+                chunk.push_back(segment);
+            if (chunk.size() == options.chunk_size || (!more && !chunk.empty()))
+            {
+                triangles.clear();
+                add_segments(stream, chunk, triangles);
+                write_triangles(output, triangles, options.format);
+                chunk.clear();
+            }
+        }
+        output.flush();
+        return stream.triangle_count;
+    }
+    default:
+        return run_pipeline(input, output, options.format, options.chunk_size);
+    }
+}
+
+// read the command line
+// returns false with a message when it cannot be used
+bool parse_options(const int argc, char* argv[], cli_options& options, string& error)
+{
+    for (auto i = 1; i < argc; ++i)
+    {
+        const string arg = argv[i];
+        const auto has_value = i + 1 < argc;
+        if (arg == "--engine" && has_value)
+        {
+            const string value = argv[++i];
+            if (value == "pipeline")
+                options.engine = engine_kind::pipeline;
+            else if (value == "batch")
+                options.engine = engine_kind::batch;
+            else if (value == "stream")
+                options.engine = engine_kind::stream;
+            else
+            {
+                error = "Unknown engine " + value;
+                return false;
+            }
+        }
+        else if (arg == "--format" && has_value)
+        {
+            const string value = argv[++i];
+            if (value == "text")
+                options.format = output_format::text;
+            else if (value == "csv")
+                options.format = output_format::csv;
+            else
+            {
+                error = "Unknown format " + value;
+                return false;
+            }
+        }
+        else if (arg == "--chunk" && has_value)
+        {
+            const auto value = atol(argv[++i]);
+            if (value <= 0)
+            {
+                error = "Chunk size must be positive";
+                return false;
+            }
+            options.chunk_size = static_cast<size_t>(value);
+        }
+        else if (arg.size() > 1 && arg[0] == '-' && arg != "-")
+        {
+            error = "Unknown option " + arg;
+            return false;
+        }
+        else if (options.input.empty())
+            options.input = arg;
+        else
+        {
+            error = "Only one input can be given";
+            return false;
+        }
+    }
+
+    if (options.input.empty())
+    {
+        error = "No input given";
+        return false;
+    }
+    return true;
+}
+
+// main entry point
+// with a file name, or - for standard input, read line segments
+// one per line as x1 y1 x2 y2 and write the triangles they form
+//     --engine pipeline|batch|stream  how the triangles are found
+//     --format text|csv               how the triangles are written
+//     --chunk N                       line segments read at a time
+// pipeline and stream visit a triangle as soon as its last segment arrives
+// so they can keep a triangle that batch drops because two of its points
+// are only joined into one vertex through points that arrive later
+// without arguments create line segments
+// calculate the triangles
+// output results
+int main(const int argc, char* argv[])
+{
+    if (argc > 1)
+    {
+        cli_options options;
+        string error;
+        if (!parse_options(argc, argv, options, error))
+        {
+            cerr << error << endl;
+            cerr << "Usage: FindTriangles [--engine pipeline|batch|stream] [--format text|csv] [--chunk N] file|-" << endl;
+            cerr << "pipeline and stream report each triangle when its last segment arrives, so they can keep one" << endl;
+            cerr << "that batch drops because two of its points only become one vertex through later points" << endl;
+            return 1;
+        }
+
+        ifstream file;
+        if (options.input != "-")
+        {
+            file.open(options.input);
+            if (!file)
+            {
+                cerr << "Cannot open " << options.input << endl;
+                return 1;
+            }
+        }
+
+        const auto text = options.format == output_format::text;
+        if (text)
+            cout << "Triangles" << endl;
+        const auto count = run_engine(options.input == "-" ? cin : file, cout, options);
+        if (text)
+            cout << endl << "There are " << count << " triangle(s) found." << endl;
+        return 0;
+    }
+
+    vector<triangle> triangles;
+    const vector<line_segment> line_segments =
+    {
+        line_segment(5, 1, 9, 9),
+        line_segment(4, 3, 7, 9),
+        line_segment(3, 5, 5, 9),
+        line_segment(2, 7, 3, 9),
+
+        line_segment(5, 1, 1, 9),
+        line_segment(6, 3, 3, 9),
+        line_segment(7, 5, 5, 9),
+        line_segment(8, 7, 7, 9),
+
+        line_segment(4, 3, 6, 3),
+        line_segment(3, 5, 7, 5),
+        line_segment(2, 7, 8, 7),
+        line_segment(1, 9, 9, 9),
+    };
+
+    calc_triangles(line_segments, triangles);
+
+    cout << "Line segments" << endl;
+    for (const auto& line_segment : line_segments)
+    {
+        cout <<
+            "(" << setw(3) << line_segment.p1.x << ", " << setw(3) << line_segment.p1.y << "), " <<
+            "(" << setw(3) << line_segment.p2.x << ", " << setw(3) << line_segment.p2.y << ")" <<
+            endl;
+    }
+    cout << endl << "Triangles" << endl;
+    for (const auto& triangle : triangles)
+    {
+        write_triangle(cout, triangle, output_format::text);
+        cout << endl;
+    }
+    cout << endl << "There are " << triangles.size() << " triangle(s) found." << endl;
+}
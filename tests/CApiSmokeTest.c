@@ -0,0 +1,89 @@
+// ReSharper disable CppInconsistentNaming
+#include "../FindTrianglesC.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Define a record of caller data with a line segment inside it
+// the interface reads the segment through a stride so the id and
+// weight around it must be skipped
+typedef struct record
+{
+    int id;
+    float x1;
+    float y1;
+    float x2;
+    float y2;
+    double weight;
+} record;
+
+// print the result of a check and count it when it failed
+static int check(const int passed, const char* what, int* failures)
+{
+    printf("%s %s\n", passed ? "ok    " : "FAILED", what);
+    if (!passed)
+        ++*failures;
+    return passed;
+}
+
+// call every function of the C interface from C
+// the segments are the 27 triangle example of the command line tool
+// returns 0 when every check passes
+int main(void)
+{
+    const record records[12] =
+    {
+        { 0, 5, 1, 9, 9, 1 }, { 1, 4, 3, 7, 9, 1 }, { 2, 3, 5, 5, 9, 1 }, { 3, 2, 7, 3, 9, 1 },
+        { 4, 5, 1, 1, 9, 1 }, { 5, 6, 3, 3, 9, 1 }, { 6, 7, 5, 5, 9, 1 }, { 7, 8, 7, 7, 9, 1 },
+        { 8, 4, 3, 6, 3, 1 }, { 9, 3, 5, 7, 5, 1 }, { 10, 2, 7, 8, 7, 1 }, { 11, 1, 9, 9, 9, 1 }
+    };
+    const long long expected_counts[12] = { 10, 9, 6, 2, 10, 9, 6, 2, 2, 6, 9, 10 };
+    const float* segments = &records[0].x1;
+    const size_t stride = sizeof(record);
+    int failures = 0;
+    size_t triangle_count = 0;
+    size_t written = 0;
+    long long counts[12];
+    long long total = 0;
+    ft_triangle* triangles;
+    ft_context* context;
+    int i;
+
+    context = ft_create();
+    if (!check(context != NULL, "ft_create returns a context", &failures))
+        return 1;
+
+    check(ft_find_triangles(context, segments, stride, 12, &triangle_count) == FT_OK && triangle_count == 27,
+        "ft_find_triangles finds 27 triangles in interleaved records", &failures);
+    check(ft_copy_triangles(context, NULL, 0, &written) == FT_BUFFER_TOO_SMALL && written == 0,
+        "ft_copy_triangles reports a buffer that is too small", &failures);
+
+    triangles = (ft_triangle*)malloc(triangle_count * sizeof(ft_triangle));
+    if (triangles != NULL)
+    {
+        check(ft_copy_triangles(context, triangles, triangle_count, &written) == FT_OK && written == triangle_count,
+            "ft_copy_triangles copies every triangle", &failures);
+        free(triangles);
+    }
+
+    check(ft_count_segment_triangles(context, segments, stride, 12, counts) == FT_OK,
+        "ft_count_segment_triangles succeeds", &failures);
+    for (i = 0; i < 12; ++i)
+    {
+        if (counts[i] != expected_counts[i])
+            break;
+        total += counts[i];
+    }
+    check(i == 12 && total == 3 * 27, "every segment is in the expected number of triangles", &failures);
+
+    check(ft_find_triangles(context, segments, sizeof(float), 12, &triangle_count) == FT_INVALID_ARGUMENT,
+        "a stride shorter than a segment is rejected", &failures);
+    check(ft_find_triangles(context, NULL, stride, 12, &triangle_count) == FT_INVALID_ARGUMENT,
+        "missing segments are rejected", &failures);
+    check(ft_find_triangles(context, NULL, stride, 0, &triangle_count) == FT_OK && triangle_count == 0,
+        "no segments give no triangles", &failures);
+
+    ft_destroy(context);
+    printf(failures == 0 ? "All C interface checks passed.\n" : "Some C interface checks FAILED.\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+// ReSharper disable CppInconsistentNaming
+#include "../FindTriangles.h"
+
+#include <cstdio>
+#include <tuple>
+
+using namespace std;
+
+// Define a triangle as a tuple so triangles can be sorted and compared exactly
+typedef tuple<float, float, float, float, float, float> triangle_key;
+
+// sort triangles so 2 runs can be compared regardless of the order they arrived in
+void sort_triangles(const vector<triangle>& triangles, vector<triangle_key>& keys)
+{
+    keys.clear();
+    for (const auto& triangle : triangles)
+        keys.emplace_back(triangle.p1.x, triangle.p1.y, triangle.p2.x, triangle.p2.y, triangle.p3.x, triangle.p3.y);
+    sort(keys.begin(), keys.end());
+}
+
+// find the triangles through a queue with a slow consumer on this thread
+// the producers block on the small queue so close and the batch
+// hand over are exercised many times per run
+template <typename Queue>
+bool check_queue(const vector<line_segment>& segments, const vector<triangle_key>& expected, const int thread_count,
+    const size_t capacity, const char* name)
+{
+    Queue queue(capacity);
+    long long pushed = 0;
+    thread producer([&]
+    {
+        pushed = calc_triangles(segments, queue, thread_count);
+    });
+
+    vector<triangle> received;
+    vector<triangle> batch;
+    while (queue.pop(batch))
+    {
+        received.insert(received.end(), batch.begin(), batch.end());
+        this_thread::sleep_for(chrono::microseconds(1));
+    }
+    producer.join();
+
+    vector<triangle_key> keys;
+    sort_triangles(received, keys);
+    const auto ok = pushed == static_cast<long long>(expected.size()) && keys == expected;
+    printf("%s threads %d capacity %d: expected %d pushed %lld received %d %s\n", name, thread_count,
+        static_cast<int>(capacity), static_cast<int>(expected.size()), pushed, static_cast<int>(keys.size()), ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// stress the bounded queues that calc_triangles pushes batches of triangles into
+// every run must deliver exactly the triangles calc_triangles returns
+// returns 0 when every run matches
+int main()
+{
+    mt19937 random(5);
+    uniform_real_distribution<float> coordinate(0, 100);
+    auto ok = true;
+    for (const auto count : { 50, 400 })
+    {
+        vector<line_segment> segments;
+        for (auto i = 0; i < count; ++i)
+            segments.emplace_back(coordinate(random), coordinate(random), coordinate(random), coordinate(random));
+
+        vector<triangle> triangles;
+        calc_triangles(segments, triangles);
+        vector<triangle_key> expected;
+        sort_triangles(triangles, expected);
+
+        for (const auto thread_count : { 1, 2, 4, 8 })
+        {
+            for (const size_t capacity : { 1, 8 })
+                ok &= check_queue<mpsc_queue<vector<triangle>>>(segments, expected, thread_count, capacity, "mpsc");
+        }
+        for (const size_t capacity : { 1, 4 })
+            ok &= check_queue<spsc_queue<vector<triangle>>>(segments, expected, 1, capacity, "spsc");
+    }
+
+    printf(ok ? "All queue runs passed.\n" : "Some queue runs FAILED.\n");
+    return ok ? 0 : 1;
+}